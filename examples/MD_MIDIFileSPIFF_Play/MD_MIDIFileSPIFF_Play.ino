@@ -11,6 +11,7 @@
 #include <MD_MIDIFileSPIFF.h>
 
 #define USE_MIDI 0  // set to 1 to enable MIDI output, otherwise debug output
+#define USE_TIMER 0 // set to 1 to play from the library timer instead of loop()
 
 #if USE_MIDI  // set up for direct MIDI serial output
 
@@ -60,19 +61,15 @@ const char *tuneList[] = {
 
 
 MD_MIDIFile SMF;
+#if USE_MIDI
+MD_MIDIOut MIDIOut(Serial);  // encodes the events with running status, one write for each tick
+#endif
 
 void midiCallback(midi_event *pev)
 // Called by the MIDIFile library when a file event needs to be processed
 // thru the midi communications interface.
 // This callback is set up in the setup() function.
 {
-#if USE_MIDI
-  if ((pev->data[0] >= 0x80) && (pev->data[0] <= 0xe0)) {
-    Serial.write(pev->data[0] | pev->channel);
-    Serial.write(&pev->data[1], pev->size - 1);
-  } else
-    Serial.write(pev->data, pev->size);
-#endif
   DEBUG("\n", millis());
   DEBUG("\tM T", pev->track);
   DEBUG(":  Ch ", pev->channel + 1);
@@ -93,25 +90,6 @@ void sysexCallback(sysex_event *pev)
     DEBUGX(" ", pev->data[i]);
 }
 
-void midiSilence(void)
-// Turn everything off on every channel.
-// Some midi files are badly behaved and leave notes hanging, so between songs turn
-// off all the notes and sound
-{
-  midi_event ev;
-
-  // All sound off
-  // When All Sound Off is received all oscillators will turn off, and their volume
-  // envelopes are set to zero as soon as possible.
-  ev.size = 0;
-  ev.data[ev.size++] = 0xb0;
-  ev.data[ev.size++] = 120;
-  ev.data[ev.size++] = 0;
-
-  for (ev.channel = 0; ev.channel < 16; ev.channel++)
-    midiCallback(&ev);
-}
-
 void setup(void) {
   // Set up LED pins
   pinMode(READY_LED, OUTPUT);
@@ -151,8 +129,12 @@ void setup(void) {
 
   // Initialize MIDIFile
   SMF.begin(&SPIFFS);
+#if USE_MIDI
+  SMF.setMidiOutput(&MIDIOut);
+#else
   SMF.setMidiHandler(midiCallback);
   SMF.setSysexHandler(sysexCallback);
+#endif
 
   digitalWrite(READY_LED, HIGH);
 }
@@ -213,6 +195,9 @@ void loop(void) {
           DEBUGS("\nWAIT_BETWEEN");
         } else {
           DEBUGS("\nS_PLAYING");
+#if USE_TIMER
+          SMF.startTimer();   // events are now played from the timer
+#endif
           state = S_PLAYING;
         }
       }
@@ -220,17 +205,22 @@ void loop(void) {
 
     case S_PLAYING:  // play the file
       //DEBUGS("\nS_PLAYING");
+#if USE_TIMER
+      // the timer plays the events, there is no tick here to drive the metronome
+      if (!SMF.isTimerRunning())
+        state = S_END;
+#else
       if (!SMF.isEOF()) {
         if (SMF.getNextEvent())
           tickMetronome();
       } else
         state = S_END;
+#endif
       break;
 
     case S_END:  // done with this one
       DEBUGS("\nS_END");
       SMF.close();
-      midiSilence();
       timeStart = millis();
       state = S_WAIT_BETWEEN;
       DEBUGS("\nWAIT_BETWEEN");
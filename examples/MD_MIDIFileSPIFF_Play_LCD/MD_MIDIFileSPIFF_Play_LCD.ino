@@ -70,6 +70,9 @@ float tempo_adjust = 0;
 // Library objects -------------
 LiquidCrystal_I2C LCD(0x27, LCD_COLS, LCD_ROWS);  // I2C address 0x27, column and rows
 MD_MIDIFile SMF;
+#if !DEBUG_ON
+MD_MIDIOut MIDIOut(Serial0);  // encodes the events with running status, one write for each tick
+#endif
 const uint8_t ANALOG_LR_PIN = A0;
 const uint8_t ANALOG_UD_PIN = A1;
 const uint8_t ANALOG_PUSH_PIN = A2;
@@ -105,13 +108,6 @@ void midiCallback(midi_event *pev)
 // thru the midi communications interface.
 // This callback is set up in the setup() function.
 {
-#if !DEBUG_ON
-  if ((pev->data[0] >= 0x80) && (pev->data[0] <= 0xe0)) {
-    Serial0.write(pev->data[0] | pev->channel);
-    Serial0.write(&pev->data[1], pev->size - 1);
-  } else
-    Serial.write(pev->data, pev->size);
-#endif
   DEBUG("\nM T", pev->track);
   DEBUG(":  Ch ", pev->channel + 1);
   DEBUGS(" Data");
@@ -131,25 +127,6 @@ void sysexCallback(sysex_event *pev)
     DEBUGX(" ", pev->data[i]);
 }
 
-void midiSilence(void)
-// Turn everything off on every channel.
-// Some midi files are badly behaved and leave notes hanging, so between songs turn
-// off all the notes and sound
-{
-  midi_event ev;
-
-  // All sound off
-  // When All Sound Off is received all oscillators will turn off, and their volume
-  // envelopes are set to zero as soon as possible.
-  ev.size = 0;
-  ev.data[ev.size++] = 0xb0;
-  ev.data[ev.size++] = 120;
-  ev.data[ev.size++] = 0;
-
-  for (ev.channel = 0; ev.channel < 16; ev.channel++)
-    midiCallback(&ev);
-}
-
 // LCD Message Helper functions -----------------
 void LCDMessage(uint8_t r, uint8_t c, const char *msg, bool clrEol = false)
 // Display a message on the LCD screen with optional spaces padding the end
@@ -372,8 +349,7 @@ seq_state midiFSM(seq_state curSS)
       if (UD.read() == MD_UISwitch::KEY_PRESS) {
         switch (UD.getKey()) {
           case 'U':
-            SMF.pause(true);
-            midiSilence();
+            SMF.pause(true);                  // also turns off the notes sounding
             break;                            // Pause
           case 'D': SMF.pause(false); break;  // Start
         }
@@ -388,7 +364,6 @@ seq_state midiFSM(seq_state curSS)
     case MSClose:
       // close the file and switch mode to user input
       SMF.close();
-      midiSilence();
       tempo_adjust = 0;
       curSS = LCDSeq;
       // fall through to default state
@@ -445,8 +420,12 @@ void setup(void) {
 
   // initialize MIDIFile
   SMF.begin(&SPIFFS);
+#if DEBUG_ON
   SMF.setMidiHandler(midiCallback);
   SMF.setSysexHandler(sysexCallback);
+#else
+  SMF.setMidiOutput(&MIDIOut);
+#endif
 
   delay(750);  // allow the welcome to be read on the LCD
 }
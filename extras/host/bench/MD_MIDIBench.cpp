@@ -0,0 +1,344 @@
+/*
+  MD_MIDIBench.cpp - Benchmark suite for the MD_MIDIFile host build.
+
+  Plays a corpus of SMF as fast as possible and reports, for each file:
+  - load     - time taken by load() (best of several loads), microseconds.
+  - file     - events decoded per second when streaming from the file system.
+  - memory   - events decoded per second from a memory image.
+  - byte/ev  - bytes read from the file system per event when streaming.
+  - read/ev  - read() calls per event when streaming.
+  - seek/ev  - seek() calls per event when streaming.
+
+  The corpus is a set of synthetic SMF written to the current directory, covering
+  dense multi-track, type 0, many track, SYSEX heavy and no running status files,
+  plus any real SMF named on the command line:
+
+    MD_MIDIBench [file.mid ...]
+
+  Every performance change should be measured against these numbers.
+*/
+#include <MD_MIDIFileSPIFF.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+#define LOAD_RUNS   20    // load() calls timed for each file
+#define PLAY_RUNS   5     // playbacks timed for each file, the best is used
+#define PLAY_TICKS  65535 // ticks passed to processEvents(), plays as fast as possible
+
+static uint32_t eventCount;
+
+static void countMidi(midi_event *) { eventCount++; }
+static void countSysex(sysex_event *) { eventCount++; }
+static void countMeta(const meta_event *) { eventCount++; }
+
+static double now(void)
+// Monotonic time in seconds
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return(t.tv_sec + t.tv_nsec * 1e-9);
+}
+
+// --------------------------------------------------------------------------
+// Synthetic SMF
+class SmfWriter
+{
+public:
+  SmfWriter(uint16_t format, uint16_t tpqn) : _format(format), _tpqn(tpqn) {}
+
+  void beginTrack(void) { _trk.clear(); _status = 0; }
+
+  void endTrack(void)
+  {
+    meta(0, 0x2f, nullptr, 0);
+    _tracks.push_back(_trk);
+  }
+
+  void midi(uint32_t dt, uint8_t status, uint8_t d1, int d2 = -1, bool runningStatus = true)
+  {
+    varLen(_trk, dt);
+    if (!runningStatus || status != _status) _trk.push_back(status);
+    _status = status;
+    _trk.push_back(d1);
+    if (d2 >= 0) _trk.push_back(d2);
+  }
+
+  void meta(uint32_t dt, uint8_t type, const uint8_t *data, uint32_t len)
+  {
+    varLen(_trk, dt);
+    _trk.push_back(0xff);
+    _trk.push_back(type);
+    varLen(_trk, len);
+    _trk.insert(_trk.end(), data, data + len);
+    _status = 0;
+  }
+
+  void tempo(uint32_t dt, uint32_t usPerQN)
+  {
+    uint8_t t[3] = { (uint8_t)(usPerQN >> 16), (uint8_t)(usPerQN >> 8), (uint8_t)usPerQN };
+
+    meta(dt, 0x51, t, sizeof(t));
+  }
+
+  void sysex(uint32_t dt, uint32_t len, uint32_t seed)
+  {
+    varLen(_trk, dt);
+    _trk.push_back(0xf0);
+    varLen(_trk, len + 1);
+    for (uint32_t i = 0; i < len; i++)
+      _trk.push_back((seed + i * 7) & 0x7f);
+    _trk.push_back(0xf7);
+    _status = 0;
+  }
+
+  bool write(const char *name)
+  {
+    std::vector<uint8_t> f = { 'M', 'T', 'h', 'd', 0, 0, 0, 6 };
+    FILE *fp;
+    bool ok;
+
+    be(f, _format, 2);
+    be(f, _tracks.size(), 2);
+    be(f, _tpqn, 2);
+    for (auto &t : _tracks)
+    {
+      f.insert(f.end(), { 'M', 'T', 'r', 'k' });
+      be(f, t.size(), 4);
+      f.insert(f.end(), t.begin(), t.end());
+    }
+
+    if ((fp = fopen(name, "wb")) == nullptr) return(false);
+    ok = fwrite(f.data(), 1, f.size(), fp) == f.size();
+    fclose(fp);
+    return(ok);
+  }
+
+private:
+  static void varLen(std::vector<uint8_t> &v, uint32_t n)
+  {
+    uint8_t b[5];
+    int i = 0;
+
+    b[i++] = n & 0x7f;
+    while ((n >>= 7) != 0)
+      b[i++] = (n & 0x7f) | 0x80;
+    while (i > 0)
+      v.push_back(b[--i]);
+  }
+
+  static void be(std::vector<uint8_t> &v, uint32_t n, int bytes)
+  {
+    while (bytes-- > 0)
+      v.push_back((n >> (bytes * 8)) & 0xff);
+  }
+
+  uint16_t _format, _tpqn;
+  uint8_t _status = 0;
+  std::vector<uint8_t> _trk;
+  std::vector<std::vector<uint8_t>> _tracks;
+};
+
+static uint32_t rnd(void)
+// Small LCG so the corpus is the same on every run
+{
+  static uint32_t seed = 12345;
+
+  seed = seed * 1103515245 + 12345;
+  return((seed >> 8) & 0xffff);
+}
+
+static void noteTrack(SmfWriter &w, uint8_t ch, uint32_t notes, uint32_t spacing, bool runningStatus, uint32_t sysexEvery = 0)
+{
+  w.midi(0, 0xc0 | ch, rnd() & 0x7f, -1, runningStatus);
+  w.midi(0, 0xb0 | ch, 7, 100, runningStatus);
+  for (uint32_t i = 0; i < notes; i++)
+  {
+    uint8_t note = 30 + rnd() % 60;
+    static const uint8_t gap[] = { 0, 0, 6, 12, 24, 48 };
+
+    w.midi(spacing ? spacing : gap[rnd() % sizeof(gap)], 0x90 | ch, note, 100, runningStatus);
+    w.midi(6 + rnd() % 24, 0x90 | ch, note, 0, runningStatus);   // note off as velocity 0
+    if (i % 37 == 0)
+      w.midi(3, 0xe0 | ch, rnd() & 0x7f, 64, runningStatus);
+    if (sysexEvery != 0 && i % sysexEvery == 0)
+      w.sysex(0, (i % (2 * sysexEvery) == 0) ? 1000 : 20, i);
+  }
+}
+
+static void conductor(SmfWriter &w, uint32_t bars)
+{
+  static const uint8_t timeSig[] = { 4, 2, 24, 8 };
+  static const uint32_t tempos[] = { 400000, 500000, 600000, 461538 };
+
+  w.meta(0, 0x58, timeSig, sizeof(timeSig));
+  w.tempo(0, 500000);
+  for (uint32_t i = 0; i < bars; i++)
+    w.tempo(384, tempos[rnd() % 4]);
+}
+
+static bool makeCorpus(std::vector<std::string> &files)
+{
+  struct { const char *name; void (*make)(SmfWriter &); uint16_t format; } corpus[] =
+  {
+    { "bench_dense16.mid", [](SmfWriter &w)  // busy type 1 song, 16 tracks
+      {
+        w.beginTrack(); conductor(w, 64); w.endTrack();
+        for (uint8_t c = 0; c < 15; c++) { w.beginTrack(); noteTrack(w, c, 2000, 0, true); w.endTrack(); }
+      }, 1 },
+    { "bench_type0.mid", [](SmfWriter &w)    // everything in one track
+      {
+        w.beginTrack(); conductor(w, 0);
+        for (uint32_t i = 0; i < 20000; i++)
+        {
+          uint8_t ch = rnd() % 16, note = 30 + rnd() % 60;
+
+          w.midi(rnd() % 3 == 0 ? 12 : 0, 0x90 | ch, note, 100);
+          w.midi(0, 0x80 | ch, note, 0);
+        }
+        w.endTrack();
+      }, 0 },
+    { "bench_tracks64.mid", [](SmfWriter &w) // many sparse tracks
+      {
+        w.beginTrack(); conductor(w, 16); w.endTrack();
+        for (uint8_t t = 0; t < 63; t++) { w.beginTrack(); noteTrack(w, t % 16, 300, 24 + t, true); w.endTrack(); }
+      }, 1 },
+    { "bench_sysex.mid", [](SmfWriter &w)    // SYSEX heavy
+      {
+        w.beginTrack(); conductor(w, 16); w.endTrack();
+        for (uint8_t c = 0; c < 4; c++) { w.beginTrack(); noteTrack(w, c, 1000, 0, true, 10); w.endTrack(); }
+      }, 1 },
+    { "bench_nors.mid", [](SmfWriter &w)     // no running status
+      {
+        w.beginTrack(); conductor(w, 64); w.endTrack();
+        for (uint8_t c = 0; c < 15; c++) { w.beginTrack(); noteTrack(w, c, 2000, 0, false); w.endTrack(); }
+      }, 1 },
+  };
+
+  for (auto &c : corpus)
+  {
+    SmfWriter w(c.format, 96);
+
+    c.make(w);
+    if (!w.write(c.name))
+    {
+      fprintf(stderr, "Cannot write %s\n", c.name);
+      return(false);
+    }
+    files.push_back(c.name);
+  }
+
+  return(true);
+}
+
+// --------------------------------------------------------------------------
+// Measurements
+static uint32_t playThrough(MD_MIDIFile &SMF)
+// Restart and play the whole file, returns the number of events
+{
+  eventCount = 0;
+  SMF.restart();
+  SMF.processEvents(0);
+  while (!SMF.isEOF())
+    SMF.processEvents(PLAY_TICKS);
+
+  return(eventCount);
+}
+
+static double bestRate(MD_MIDIFile &SMF)
+// Best events per second over several playbacks
+{
+  double best = 0;
+
+  for (int i = 0; i < PLAY_RUNS; i++)
+  {
+    double t = now();
+    uint32_t n = playThrough(SMF);
+
+    t = now() - t;
+    if (t > 0 && n / t > best) best = n / t;
+  }
+
+  return(best);
+}
+
+static bool bench(MD_MIDIFile &SMF, const char *name)
+{
+  std::vector<uint8_t> image;
+  double loadTime = 1e9, fileRate, memRate;
+  uint32_t events;
+  uint8_t tracks;
+  shim_stats io;
+  int err;
+  FILE *fp;
+
+  // load() time
+  for (int i = 0; i < LOAD_RUNS; i++)
+  {
+    double t = now();
+
+    err = SMF.load(name);
+    t = now() - t;
+    if (err != MD_MIDIFile::E_OK)
+    {
+      printf("%-24s load error %d\n", name, err);
+      return(false);
+    }
+    if (t < loadTime) loadTime = t;
+    if (i != LOAD_RUNS - 1) SMF.close();
+  }
+
+  // streamed from the file system
+  memset(&shimStats, 0, sizeof(shimStats));
+  events = playThrough(SMF);
+  io = shimStats;
+  fileRate = bestRate(SMF);
+  SMF.close();
+
+  // memory image
+  if ((fp = fopen(name, "rb")) == nullptr) return(false);
+  fseek(fp, 0, SEEK_END);
+  image.resize(ftell(fp));
+  fseek(fp, 0, SEEK_SET);
+  if (fread(image.data(), 1, image.size(), fp) != image.size()) image.clear();
+  fclose(fp);
+  if (image.empty() || SMF.load(image.data(), image.size()) != MD_MIDIFile::E_OK)
+    return(false);
+  tracks = SMF.getTrackCount();
+  memRate = bestRate(SMF);
+  SMF.close();
+
+  printf("%-24s %8zu %6u %8u %8.0f %8.2f %8.2f %8.2f %8.3f %8.3f\n",
+    name, image.size(), tracks, events, loadTime * 1e6,
+    fileRate / 1e6, memRate / 1e6,
+    events ? (double)io.readBytes / events : 0.0,
+    events ? (double)io.reads / events : 0.0,
+    events ? (double)io.seeks / events : 0.0);
+
+  return(true);
+}
+
+int main(int argc, char *argv[])
+{
+  static MD_MIDIFile SMF;
+  std::vector<std::string> files;
+  int fails = 0;
+
+  if (!makeCorpus(files))
+    return(1);
+  for (int i = 1; i < argc; i++)
+    files.push_back(argv[i]);
+
+  SMF.setMidiHandler(countMidi);
+  SMF.setSysexHandler(countSysex);
+  SMF.setMetaHandler(countMeta);
+
+  printf("%-24s %8s %6s %8s %8s %8s %8s %8s %8s %8s\n",
+    "File", "Bytes", "Tracks", "Events", "load us", "file M/s", "mem M/s", "byte/ev", "read/ev", "seek/ev");
+  for (auto &f : files)
+    if (!bench(SMF, f.c_str()))
+      fails++;
+
+  return(fails == 0 ? 0 : 1);
+}
@@ -0,0 +1,244 @@
+/*
+  MD_MIDICheck.cpp - Functional checks for the MD_MIDIFile host build.
+
+  Runs the library against small SMF built in memory (and written to the current
+  directory where a file is needed) and reports any check that fails. The exit
+  code is the number of failures, so the program is run by ctest:
+
+    ctest --test-dir build
+*/
+#include <MD_MIDIFileSPIFF.h>
+#include <stdio.h>
+#include <vector>
+
+#define TPQN      96      // ticks per quarter note
+#define US_PER_QN 500000  // 120 bpm
+#define NOTES     400     // one note on each quarter note
+
+static int fails;
+static uint32_t midiCount;
+static std::vector<uint8_t> noteOnTracks;
+
+static void countMidi(midi_event *pev)
+{
+  midiCount++;
+  if (pev->data[0] == 0x90 && pev->data[2] != 0)
+    noteOnTracks.push_back(pev->track);
+}
+
+static void check(bool ok, const char *what)
+{
+  printf("%-56s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok) fails++;
+}
+
+static void be(std::vector<uint8_t> &v, uint32_t n, int bytes)
+// Append a big endian number
+{
+  while (bytes-- > 0)
+    v.push_back((n >> (bytes * 8)) & 0xff);
+}
+
+static std::vector<uint8_t> makeFile(const std::vector<std::vector<uint8_t>> &tracks)
+// SMF with the track data given, type 0 for one track and type 1 for more
+{
+  std::vector<uint8_t> f = { 'M', 'T', 'h', 'd', 0, 0, 0, 6 };
+
+  be(f, tracks.size() == 1 ? 0 : 1, 2);
+  be(f, tracks.size(), 2);
+  be(f, TPQN, 2);
+  for (auto &t : tracks)
+  {
+    f.insert(f.end(), { 'M', 'T', 'r', 'k' });
+    be(f, t.size(), 4);
+    f.insert(f.end(), t.begin(), t.end());
+  }
+
+  return(f);
+}
+
+static std::vector<uint8_t> makeSmf(void)
+// Type 0 SMF with a note on and off on every quarter note
+{
+  std::vector<uint8_t> trk = { 0x00, 0xff, 0x51, 0x03, (US_PER_QN >> 16) & 0xff, (US_PER_QN >> 8) & 0xff, US_PER_QN & 0xff };
+
+  for (int i = 0; i < NOTES; i++)
+  {
+    trk.insert(trk.end(), { 0x00, 0x90, 60, 100 });
+    trk.insert(trk.end(), { 0x80 | (TPQN >> 7), TPQN & 0x7f, 0x80, 60, 0 });
+  }
+  trk.insert(trk.end(), { 0x00, 0xff, 0x2f, 0x00 });
+
+  return(makeFile({ trk }));
+}
+
+static bool writeFile(const char *name, const std::vector<uint8_t> &data)
+{
+  FILE *fp = fopen(name, "wb");
+  bool ok;
+
+  if (fp == nullptr) return(false);
+  ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+  fclose(fp);
+  return(ok);
+}
+
+static void checkTruncated(MD_MIDIFile &SMF, size_t cut, const char *what)
+// A track that ends inside an event is not compiled, loadCompiled() plays the SMF
+{
+  std::vector<uint8_t> smf = makeSmf();
+  size_t len = smf.size() - cut - 22;   // track data length
+
+  smf.resize(smf.size() - cut);
+  for (int i = 0; i < 4; i++)
+    smf[18 + i] = (len >> ((3 - i) * 8)) & 0xff;
+
+  remove("check_cut.mdev");
+  check(writeFile("check_cut.mid", smf) &&
+    MD_MIDIFile::compile("check_cut.mid", "check_cut.mdev") == (10 + MD_MIDIFile::E_CHUNK_EOF) &&
+    SMF.loadCompiled("check_cut.mid", "check_cut.mdev") == MD_MIDIFile::E_OK, what);
+  SMF.close();
+  remove("check_cut.mid");
+  remove("check_cut.mdev");
+}
+
+static uint32_t playAll(MD_MIDIFile &SMF)
+// Play the loaded file as fast as possible, returns the number of MIDI events
+{
+  midiCount = 0;
+  noteOnTracks.clear();
+  SMF.setMidiHandler(countMidi);
+  SMF.processEvents(0);
+  while (!SMF.isEOF())
+    SMF.processEvents(65535);
+  SMF.setMidiHandler(nullptr);
+  SMF.close();
+
+  return(midiCount);
+}
+
+static void checkCompiled(MD_MIDIFile &SMF, const std::vector<uint8_t> &smf, const char *what)
+// The compiled file plays the same MIDI events as the SMF, with the notes in the same order
+{
+  std::vector<uint8_t> order;
+  uint32_t events = 0;
+  bool ok;
+
+  SMF.setScheduler(MD_MIDIFile::SCHED_TIME);
+  ok = writeFile("check_dev.mid", smf) && SMF.load("check_dev.mid") == MD_MIDIFile::E_OK;
+  if (ok)
+  {
+    events = playAll(SMF);
+    order = noteOnTracks;
+  }
+  ok = ok && MD_MIDIFile::compile("check_dev.mid", "check_dev.mdev") == MD_MIDIFile::E_OK &&
+    SMF.load("check_dev.mdev") == MD_MIDIFile::E_OK && playAll(SMF) == events && events != 0 &&
+    noteOnTracks == order;
+  check(ok, what);
+  remove("check_dev.mid");
+  remove("check_dev.mdev");
+}
+
+static std::vector<uint8_t> makeTracks(uint16_t count)
+// Type 1 SMF with count tracks, track n playing a note at tick n
+{
+  std::vector<std::vector<uint8_t>> tracks;
+
+  for (uint16_t i = 0; i < count; i++)
+  {
+    uint8_t ch = i & 0xf;
+
+    tracks.push_back({ (uint8_t)(0x80 | (i >> 7)), (uint8_t)(i & 0x7f), (uint8_t)(0x90 | ch), 60, 100,
+      0x10, (uint8_t)(0x80 | ch), 60, 0, 0x00, 0xff, 0x2f, 0x00 });
+  }
+
+  return(makeFile(tracks));
+}
+
+static std::vector<uint8_t> makeSysex(uint32_t len)
+// Type 0 SMF with a SYSEX of len bytes before the notes
+{
+  std::vector<uint8_t> smf = makeSmf();
+  std::vector<uint8_t> ev = { 0x00, 0xf0 };
+  size_t trk = 22 + 7;    // after the tempo event
+  uint32_t size;
+
+  for (int shift = 21; shift > 0; shift -= 7)
+    if (len >> shift) ev.push_back(0x80 | ((len >> shift) & 0x7f));
+  ev.push_back(len & 0x7f);
+  ev.insert(ev.end(), len - 1, 0x7e);
+  ev.push_back(0xf7);
+
+  smf.insert(smf.begin() + trk, ev.begin(), ev.end());
+  size = smf.size() - 22;
+  for (int i = 0; i < 4; i++)
+    smf[18 + i] = (size >> ((3 - i) * 8)) & 0xff;
+
+  return(smf);
+}
+
+static void checkWindowAfterSeek(MD_MIDIFile &SMF, uint32_t tick, const char *what)
+// The first event after a seek is due when the song time says it is
+{
+  const uint32_t tickUs = US_PER_QN / TPQN;
+  timed_event buf[8];
+  uint32_t now, expect;
+  uint16_t n;
+
+  SMF.seekToTick(tick);
+  now = micros();
+  n = SMF.getEventWindow(2 * US_PER_QN / 1000, buf, 8);
+  expect = now + ((TPQN - (tick % TPQN)) % TPQN) * tickUs;
+
+  check(n != 0 && buf[0].tick >= tick && (int32_t)(buf[0].time - expect) < 20000 && (int32_t)(expect - buf[0].time) < 20000, what);
+}
+
+int main(void)
+{
+  static MD_MIDIFile SMF;
+  std::vector<uint8_t> smf = makeSmf();
+
+  check(SMF.load(smf.data(), smf.size()) == MD_MIDIFile::E_OK, "load()");
+
+  checkWindowAfterSeek(SMF, 200 * TPQN + 10, "getEventWindow() after a forward seekToTick()");
+  checkWindowAfterSeek(SMF, 20 * TPQN + 10, "getEventWindow() after a backward seekToTick()");
+  SMF.close();
+
+  // the track ends ... 0x80 0x60 (delta) 0x80 60 0 (note off) 0x00 0xff 0x2f 0x00 (end of track)
+  checkTruncated(SMF, 5, "compile() with a track ending inside a message");
+  checkTruncated(SMF, 7, "compile() with a track ending after a delta time");
+  checkTruncated(SMF, 8, "compile() with a track ending inside a delta time");
+
+  checkCompiled(SMF, makeTracks(200), "compile() with 200 tracks");
+  checkCompiled(SMF, makeSysex(70000), "compile() with a SYSEX longer than a record");
+
+  {
+    alignas(MD_MFTrack) static uint8_t arena[MD_MIDIFile::getTrackArenaSize(1)];
+    std::vector<uint8_t> big = makeTracks(4);
+
+    // a file that does not fit leaves nothing to play
+    SMF.setTrackArena(arena, sizeof(arena));
+    check(SMF.load(smf.data(), smf.size()) == MD_MIDIFile::E_OK &&
+      SMF.load(big.data(), big.size()) == MD_MIDIFile::E_TRACKS &&
+      SMF.isEOF() && !SMF.getNextEvent(), "playing after load() fails with E_TRACKS");
+    SMF.close();
+    SMF.setTrackArena(nullptr, 0);
+  }
+
+  {
+    // the second track starts with a data byte and no status to run on
+    std::vector<uint8_t> bad = makeFile({
+      { 0x00, 0x90, 60, 100, 0x10, 0x80, 60, 0, 0x00, 0xff, 0x2f, 0x00 },
+      { 0x00, 64, 100, 0x00, 0x90, 64, 100, 0x10, 0x80, 64, 0, 0x00, 0xff, 0x2f, 0x00 } });
+
+    check(SMF.load(bad.data(), bad.size()) == MD_MIDIFile::E_OK && playAll(SMF) == 2 &&
+      noteOnTracks == std::vector<uint8_t>{ 0 }, "running status data with no status ends the track");
+  }
+
+  SMF.setTempoAdjust(10);
+  SMF.setTempo(0);
+  check(SMF.getTempo() != 0, "setTempo(0) is ignored");
+  SMF.setTempoAdjust(0);
+
+  return(fails);
+}
@@ -0,0 +1,77 @@
+/*
+  Arduino.h - Minimal Arduino core shim for the MD_MIDIFile host build.
+
+  Provides only what the library uses: integer types, min/max, micros()/millis()/
+  delay() from the POSIX monotonic clock, the Print output interface and a Serial
+  object that prints to stdout (for DUMP_DATA).
+*/
+#ifndef _SHIM_ARDUINO_H
+#define _SHIM_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <type_traits>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+using std::max;
+template <class A, class B> inline typename std::common_type<A, B>::type min(A a, B b) { return(a < b ? a : b); }
+
+#define F(s)    (s)
+#define DEC     10
+#define HEX     16
+
+inline uint32_t micros(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return((uint32_t)(t.tv_sec * 1000000ULL + t.tv_nsec / 1000));
+}
+
+inline uint32_t millis(void) { return(micros() / 1000); }
+inline void delay(uint32_t ms) { usleep(ms * 1000); }
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size)
+  {
+    size_t n = 0;
+
+    while (size-- > 0)
+      n += write(*buf++);
+    return(n);
+  }
+};
+
+class HardwareSerial : public Print
+{
+public:
+  size_t write(uint8_t b) override { return(fputc(b, stdout) == EOF ? 0 : 1); }
+  size_t write(const uint8_t *buf, size_t size) override { return(fwrite(buf, 1, size, stdout)); }
+  void begin(unsigned long) {}
+  void print(const char *s) { fputs(s, stdout); }
+  void print(char c) { fputc(c, stdout); }
+  void print(long v, int base = DEC) { printf(base == HEX ? "%lx" : "%ld", v); }
+  void print(unsigned long v, int base = DEC) { printf(base == HEX ? "%lx" : "%lu", v); }
+  void print(int v, int base = DEC) { print((long)v, base); }
+  void print(unsigned int v, int base = DEC) { print((unsigned long)v, base); }
+  void print(unsigned char v, int base = DEC) { print((unsigned long)v, base); }
+  void print(double v) { printf("%.2f", v); }
+  template <class T> void println(T v) { print(v); fputc('\n', stdout); }
+  void println(void) { fputc('\n', stdout); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  FS.h - Minimal Arduino file system shim for the MD_MIDIFile host build.
+
+  File wraps a stdio FILE and counts the calls made to the file system in
+  shimStats, so the I/O done by the library can be measured.
+*/
+#ifndef _SHIM_FS_H
+#define _SHIM_FS_H
+
+#include "Arduino.h"
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+/**
+ * File system calls made since the counters were last cleared.
+ */
+struct shim_stats
+{
+  uint32_t opens;       ///< files opened
+  uint32_t reads;       ///< read() calls
+  uint32_t readBytes;   ///< bytes returned by read()
+  uint32_t seeks;       ///< seek() calls
+};
+
+extern shim_stats shimStats;
+
+class File
+{
+public:
+  File(void) {}
+  File(FILE *f) : _f(f) { if (_f != nullptr) shimStats.opens++; }
+
+  int read(void)
+  {
+    int c;
+
+    shimStats.reads++;
+    if (_f == nullptr || (c = fgetc(_f)) == EOF) return(-1);
+    shimStats.readBytes++;
+    return(c);
+  }
+
+  size_t read(uint8_t *buf, size_t len)
+  {
+    size_t n;
+
+    shimStats.reads++;
+    if (_f == nullptr) return(0);
+    n = fread(buf, 1, len, _f);
+    shimStats.readBytes += n;
+    return(n);
+  }
+
+  bool seek(uint32_t pos, SeekMode mode = SeekSet)
+  {
+    shimStats.seeks++;
+    if (_f == nullptr) return(false);
+    return(fseek(_f, (long)(int32_t)pos, mode == SeekSet ? SEEK_SET : (mode == SeekCur ? SEEK_CUR : SEEK_END)) == 0);
+  }
+
+  size_t position(void) { return(_f != nullptr ? ftell(_f) : 0); }
+
+  size_t size(void)
+  {
+    long cur, end;
+
+    if (_f == nullptr) return(0);
+    cur = ftell(_f);
+    fseek(_f, 0, SEEK_END);
+    end = ftell(_f);
+    fseek(_f, cur, SEEK_SET);
+    return(end);
+  }
+
+  size_t write(const uint8_t *buf, size_t len) { return(_f != nullptr ? fwrite(buf, 1, len, _f) : 0); }
+  time_t getLastWrite(void) { return(0); }
+  void close(void) { if (_f != nullptr) fclose(_f); _f = nullptr; }
+  operator bool() const { return(_f != nullptr); }
+
+private:
+  FILE *_f = nullptr;
+};
+
+class FS
+{
+public:
+  bool begin(bool formatOnFail = false) { (void)formatOnFail; return(true); }
+  File open(const char *name, const char *mode = "r") { return(File(fopen(name, mode[0] == 'w' ? "wb" : "rb"))); }
+  bool exists(const char *name) { return(access(name, F_OK) == 0); }
+  bool remove(const char *name) { return(::remove(name) == 0); }
+};
+
+#endif
@@ -0,0 +1,13 @@
+/*
+  SPIFFS.h - SPIFFS shim for the MD_MIDIFile host build.
+
+  File names are paths in the host file system.
+*/
+#ifndef _SHIM_SPIFFS_H
+#define _SHIM_SPIFFS_H
+
+#include "FS.h"
+
+extern FS SPIFFS;
+
+#endif
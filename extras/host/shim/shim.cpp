@@ -0,0 +1,8 @@
+/*
+  shim.cpp - Global objects for the MD_MIDIFile host build shim.
+*/
+#include "SPIFFS.h"
+
+HardwareSerial Serial;
+FS SPIFFS;
+shim_stats shimStats;
@@ -0,0 +1,696 @@
+/*
+  MD_MIDIDev.cpp - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "MD_MIDIFileSPIFF.h"
+#include "MD_MIDIHelper.h"
+
+/**
+ * \file
+ * \brief Main file for the compiled event stream (.mdev) conversion and playback
+ */
+
+// Compiler state for one SMF track
+typedef struct
+{
+  MD_MFSourceMem src;   // track data in the SMF image, ending at the end of the track
+  uint32_t  start;      // offset of the start of the track in the image
+  uint32_t  tick;       // absolute tick of the next event
+  uint8_t   rs;         // running status
+  bool      eot;        // true when the end of the track is reached
+} devTrack_t;
+
+// Compiler state for the SMF
+typedef struct
+{
+  const uint8_t *image; // the SMF image
+  uint32_t  size;       // size of the image
+  uint8_t   format;     // SMF format
+  uint8_t   trackCount; // number of tracks
+  uint16_t  tpqn;       // ticks per quarter note
+  devTrack_t *track;    // the tracks, trackCount of them
+
+  // tempo map position used to convert ticks to microseconds
+  uint32_t  anchorTick; // tick of the last tempo change
+  uint32_t  anchorTime; // microseconds at the last tempo change
+  uint32_t  usPerQN;    // current tempo in microseconds per quarter note
+
+  // totals from the compile
+  uint32_t  records;    // number of records written
+  uint32_t  events;     // number of events written
+  uint32_t  duration;   // time of the last event in microseconds
+  uint32_t  clipped;    // number of SYSEX/META events cut to fit the record length
+  uint8_t   truncated;  // 1 + number of the first track that ends inside an event, 0 if none
+} devSmf_t;
+
+// Byte sink that only counts what is written, used to size the output
+class devCounter
+{
+public:
+  size_t write(const uint8_t *buf, size_t len) { (void)buf; _count += len; return(len); }
+  uint32_t _count = 0;
+};
+
+static int devParseSmf(devSmf_t *smf)
+// Read the SMF header and find the track chunks, return one of the E_* codes
+{
+  MD_MFSourceMem src;
+  uint16_t dat16;
+  char h[MTHD_HDR_SIZE+1];
+
+  src.open(smf->image, smf->size);
+
+  src.read((uint8_t *)h, MTHD_HDR_SIZE);
+  h[MTHD_HDR_SIZE] = '\0';
+  if (strcmp(h, MTHD_HDR) != 0)
+    return(MD_MIDIFile::E_NOT_MIDI);
+
+  if (readMultiByte(&src, MB_LONG) != 6)
+    return(MD_MIDIFile::E_HEADER);
+
+  dat16 = readMultiByte(&src, MB_WORD);
+  if ((dat16 != 0) && (dat16 != 1))
+    return(MD_MIDIFile::E_FORMAT);
+  smf->format = dat16;
+
+  dat16 = readMultiByte(&src, MB_WORD);
+  if ((smf->format == 0) && (dat16 != 1))
+    return(MD_MIDIFile::E_FORMAT0);
+  if (dat16 > MIDI_MAX_TRACKS)
+    return(MD_MIDIFile::E_TRACKS);
+  smf->trackCount = dat16;
+  if ((smf->track = (devTrack_t *)calloc(dat16 == 0 ? 1 : dat16, sizeof(devTrack_t))) == nullptr)
+    return(MD_MIDIFile::E_NO_MEMORY);
+
+  // ticks per quarter note, interpreted as for MD_MIDIFile::load()
+  dat16 = readMultiByte(&src, MB_WORD);
+  if (dat16 & 0x8000)
+  {
+    int framespersecond = (dat16 >> 8) & 0x00ff;
+
+    switch (framespersecond)
+    {
+      case 232:  framespersecond = 24; break;
+      case 231:  framespersecond = 25; break;
+      case 227:  framespersecond = 29; break;
+      case 226:  framespersecond = 30; break;
+      default:   return(7);
+    }
+    dat16 = framespersecond * (dat16 & 0x00ff);
+  }
+  smf->tpqn = dat16;
+
+  for (uint8_t i = 0; i < smf->trackCount; i++)
+  {
+    uint32_t len, start;
+
+    src.read((uint8_t *)h, MTRK_HDR_SIZE);
+    h[MTRK_HDR_SIZE] = '\0';
+    if (strcmp(h, MTRK_HDR) != 0)
+      return((10*(i+1)) + MD_MIDIFile::E_CHUNK_ID);
+
+    len = readMultiByte(&src, MB_LONG);
+    start = src.position();
+    if (!src.seek(start + len))
+      return((10*(i+1)) + MD_MIDIFile::E_CHUNK_EOF);
+
+    smf->track[i].start = start;
+    smf->track[i].src.open(smf->image, start + len);
+    smf->track[i].src.seek(start);
+  }
+
+  return(MD_MIDIFile::E_OK);
+}
+
+static uint32_t devTime(devSmf_t *smf, uint32_t tick)
+// Microseconds from the start of the song for the tick
+{
+  return(smf->anchorTime + (uint32_t)(((uint64_t)(tick - smf->anchorTick) * smf->usPerQN) / smf->tpqn));
+}
+
+static void devNextDelta(devTrack_t *t)
+// Add the delta time for the next event in the track
+{
+  if (t->src.position() >= t->src.size())
+    t->eot = true;
+  else
+    t->tick += readVarLen(&t->src);
+}
+
+static bool devRead(devSmf_t *smf, uint8_t i, uint8_t *b)
+// Read the next byte of track i, false if the track data ends first
+{
+  devTrack_t *t = &smf->track[i];
+
+  if (t->src.position() >= t->src.size())
+  {
+    t->eot = true;
+    if (smf->truncated == 0) smf->truncated = i + 1;
+    return(false);
+  }
+
+  *b = t->src.read();
+  return(true);
+}
+
+static bool devSkip(devSmf_t *smf, uint8_t i, uint32_t len)
+// Move past len bytes of track i, false if the track data ends first
+{
+  devTrack_t *t = &smf->track[i];
+
+  if (len > t->src.size() - t->src.position())
+  {
+    t->eot = true;
+    if (smf->truncated == 0) smf->truncated = i + 1;
+    return(false);
+  }
+
+  t->src.seek(t->src.position() + len);
+  return(true);
+}
+
+static bool devVarLen(devSmf_t *smf, uint8_t i, uint32_t *value)
+// Read a variable length number from track i, false if the track data ends first
+{
+  uint8_t c;
+
+  *value = 0;
+  for (uint8_t n = 0; n < 4; n++)   // the SMF limit
+  {
+    if (!devRead(smf, i, &c))
+      return(false);
+    *value = (*value << 7) + (c & 0x7f);
+    if ((c & 0x80) == 0)
+      break;
+  }
+
+  return(true);
+}
+
+template <class W> static void devRecord(devSmf_t *smf, W *out, uint32_t tick, uint8_t track, uint8_t status, uint16_t param)
+// Write one event record
+{
+  uint8_t rec[MDEV_REC_SIZE];
+  uint32_t t = devTime(smf, tick);
+
+  putLE32(&rec[0], tick);
+  putLE32(&rec[4], t);
+  rec[8] = track;
+  rec[9] = status;
+  putLE16(&rec[10], param);
+  out->write(rec, MDEV_REC_SIZE);
+
+  smf->records++;
+  smf->events++;
+  if (t > smf->duration) smf->duration = t;
+}
+
+template <class W> static void devPayload(devSmf_t *smf, W *out, int16_t first, const uint8_t *data, uint16_t len)
+// Write SYSEX or META data (first byte if not -1, plus len bytes) padded to whole records
+{
+  uint8_t rec[MDEV_REC_SIZE];
+  uint16_t n = 0;
+
+  if (first != -1)
+    rec[n++] = first;
+
+  for (uint16_t i = 0; i < len; i++)
+  {
+    rec[n++] = data[i];
+    if (n == MDEV_REC_SIZE)
+    {
+      out->write(rec, MDEV_REC_SIZE);
+      smf->records++;
+      n = 0;
+    }
+  }
+
+  if (n != 0)
+  {
+    memset(&rec[n], 0, MDEV_REC_SIZE - n);
+    out->write(rec, MDEV_REC_SIZE);
+    smf->records++;
+  }
+}
+
+template <class W> static void devEvent(devSmf_t *smf, uint8_t i, W *out)
+// Convert the next event in track i into records
+{
+  devTrack_t *t = &smf->track[i];
+  uint8_t status, d1 = 0, d2 = 0;
+
+  if (!devRead(smf, i, &status))
+    return;
+
+  if (status < 0x80)            // running status, this is the first data byte
+  {
+    d1 = status;
+    status = t->rs;
+  }
+  else if (status < 0xf0)       // new MIDI status
+  {
+    t->rs = status;
+    if (!devRead(smf, i, &d1))
+      return;
+  }
+
+  switch (status & 0xf0)
+  {
+    case 0x80: case 0x90: case 0xa0: case 0xb0: case 0xe0:  // 2 data bytes
+      if (!devRead(smf, i, &d2))
+        return;
+      devRecord(smf, out, t->tick, i, status, d1 | (d2 << 8));
+      break;
+
+    case 0xc0: case 0xd0:                                   // 1 data byte
+      devRecord(smf, out, t->tick, i, status, d1);
+      break;
+
+    default:
+      if (status == 0xf0 || status == 0xf7)         // SYSEX
+      {
+        uint32_t len, pos;
+
+        if (!devVarLen(smf, i, &len))
+          return;
+        pos = t->src.position();
+        if (!devSkip(smf, i, len))
+          return;
+
+        // only the record length is limited, the track carries on after all the data.
+        // 0xfffe leaves room for the 0xF0 added to the 16 bit sysex_event size.
+        if (len > 0xfffe)
+        {
+          len = 0xfffe;
+          smf->clipped++;
+        }
+        devRecord(smf, out, t->tick, i, status, len);
+        devPayload(smf, out, -1, smf->image + pos, len);
+      }
+      else if (status == 0xff)                      // META
+      {
+        uint8_t type;
+        uint32_t len, pos;
+
+        if (!devRead(smf, i, &type) || !devVarLen(smf, i, &len))
+          return;
+        pos = t->src.position();
+        if (!devSkip(smf, i, len))
+          return;
+
+        if (len > 0xfffe)
+        {
+          len = 0xfffe;
+          smf->clipped++;
+        }
+
+        if (type == 0x51 && len >= 3)   // tempo change, move the tempo map anchor
+        {
+          smf->anchorTime = devTime(smf, t->tick);
+          smf->anchorTick = t->tick;
+          smf->usPerQN = ((uint32_t)smf->image[pos] << 16) + ((uint32_t)smf->image[pos+1] << 8) + smf->image[pos+2];
+          if (smf->usPerQN == 0) smf->usPerQN = 500000;
+        }
+        if (type == 0x2f)
+          t->eot = true;
+
+        // META data is stored with the type as the first byte
+        devRecord(smf, out, t->tick, i, status, len + 1);
+        devPayload(smf, out, type, smf->image + pos, len);
+      }
+      else                                          // cannot identify the event
+        t->eot = true;
+      break;
+  }
+
+  if (!t->eot)
+    devNextDelta(t);
+}
+
+template <class W> static void devCompile(devSmf_t *smf, W *out)
+// Merge all the tracks into records in time order
+{
+  // initialise the tracks and the tempo map
+  for (uint8_t i = 0; i < smf->trackCount; i++)
+  {
+    devTrack_t *t = &smf->track[i];
+
+    t->src.seek(t->start);
+    t->tick = 0;
+    t->rs = 0;
+    t->eot = false;
+  }
+  smf->anchorTick = smf->anchorTime = 0;
+  smf->usPerQN = 500000;
+  smf->records = smf->events = smf->duration = 0;
+  smf->clipped = 0;
+  smf->truncated = 0;
+
+  for (uint8_t i = 0; i < smf->trackCount; i++)
+    devNextDelta(&smf->track[i]);
+
+  // k-way merge, earliest tick first and lowest track for the same tick
+  while (true)
+  {
+    int16_t next = -1;   // up to 255 tracks
+
+    for (uint8_t i = 0; i < smf->trackCount; i++)
+    {
+      if (!smf->track[i].eot && (next == -1 || smf->track[i].tick < smf->track[next].tick))
+        next = i;
+    }
+
+    if (next == -1)
+      break;
+
+    devEvent(smf, next, out);
+  }
+}
+
+int MD_MIDIFile::compile(const char *smfName, const char *devName)
+// Convert the SMF into a compiled event stream file
+{
+  MD_MFSource in, out;
+  devSmf_t *smf;
+  uint8_t *image;
+  uint8_t hdr[MDEV_HDR_SIZE];
+  uint32_t size, mtime;
+  int err;
+
+  if ((smfName == nullptr) || (*smfName == '\0') || (devName == nullptr) || (*devName == '\0'))
+    return(E_NO_FILE);
+
+  if (!in.open(smfName))
+    return(E_NO_OPEN);
+
+  // work from a copy of the whole SMF in memory
+  size = in.size();
+  mtime = in.mtime();
+  image = (uint8_t *)malloc(size);
+  smf = (devSmf_t *)malloc(sizeof(devSmf_t));
+  if (image == nullptr || smf == nullptr)
+  {
+    free(image);
+    free(smf);
+    in.close();
+    return(E_NO_MEMORY);
+  }
+  memset((void *)smf, 0, sizeof(devSmf_t));
+  size = in.read(image, size);
+  in.close();
+
+  smf->image = image;
+  smf->size = size;
+  err = devParseSmf(smf);
+
+  if (err == E_OK)
+  {
+    devCounter count;
+
+    // first pass works out the size of the output for the header
+    devCompile(smf, &count);
+    if (smf->truncated != 0)
+      err = (10 * smf->truncated) + E_CHUNK_EOF;
+  }
+
+  if (err == E_OK)
+  {
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(&hdr[0], MDEV_HDR, 4);
+    putLE16(&hdr[4], MDEV_VERSION);
+    putLE16(&hdr[6], smf->tpqn);
+    putLE32(&hdr[8], smf->records);
+    putLE32(&hdr[12], smf->events);
+    putLE32(&hdr[16], size);
+    putLE32(&hdr[20], mtime);
+    putLE32(&hdr[24], smf->duration);
+    hdr[28] = smf->format;
+    hdr[29] = smf->trackCount;
+    putLE16(&hdr[30], (smf->clipped > 0xffff) ? 0xffff : smf->clipped);
+
+    // second pass writes the file
+    if (!out.create(devName))
+      err = E_WRITE;
+    else
+    {
+      if (out.write(hdr, sizeof(hdr)) != sizeof(hdr))
+        err = E_WRITE;
+      else
+      {
+        devCompile(smf, &out);
+        if (out.position() != MDEV_HDR_SIZE + (smf->records * MDEV_REC_SIZE))
+          err = E_WRITE;
+      }
+      out.close();
+    }
+  }
+
+  DUMP("\nCompiled ", devName);
+  DUMP(" error ", err);
+  DUMP(" clipped ", smf->clipped);
+
+  free(image);
+  free(smf->track);
+  free(smf);
+
+  return(err);
+}
+
+bool MD_MIDIFile::isCompiledValid(const char *smfName, const char *devName)
+// Check the compiled file was made from the current version of the SMF
+{
+  MD_MFSource f;
+  uint8_t hdr[MDEV_HDR_SIZE];
+  uint32_t size, mtime;
+
+  if (!f.open(smfName))
+    return(false);
+  size = f.size();
+  mtime = f.mtime();
+  f.close();
+
+  if (!f.open(devName))
+    return(false);
+  if (f.read(hdr, sizeof(hdr)) != sizeof(hdr))
+    memset(hdr, 0, sizeof(hdr));
+  f.close();
+
+  return((memcmp(&hdr[0], MDEV_HDR, 4) == 0) &&
+    (getLE16(&hdr[4]) == MDEV_VERSION) &&
+    (getLE32(&hdr[16]) == size) &&
+    (getLE32(&hdr[20]) == mtime));
+}
+
+int MD_MIDIFile::loadCompiled(const char *smfName, const char *devName)
+// Play the compiled version of the SMF, compiling it first if needed
+{
+  if (!isCompiledValid(smfName, devName))
+  {
+    // if it can't be compiled just play the original
+    if (compile(smfName, devName) != E_OK)
+      return(load(smfName));
+  }
+
+  return(load(devName));
+}
+
+int MD_MIDIFile::loadDev(void)
+// Read the header of the compiled event stream just opened by load()
+{
+  uint8_t hdr[MDEV_HDR_SIZE];
+
+  if ((_fd.read(hdr, sizeof(hdr)) != sizeof(hdr)) || (getLE16(&hdr[4]) != MDEV_VERSION))
+    return(E_HEADER);
+
+  _ticksPerQuarterNote = getLE16(&hdr[6]);
+  _devRecords = getLE32(&hdr[8]);
+  _format = hdr[28];
+  _trackCount = hdr[29];
+  _devMode = true;
+
+  calcTickTime();
+  devRestart();
+
+  return(E_OK);
+}
+
+void MD_MIDIFile::devRestart(void)
+// Go back to the first record
+{
+  _fd.seek(MDEV_HDR_SIZE);
+  _devIndex = 0;
+  _devPending = false;
+  _devTimeFP = 0;
+}
+
+bool MD_MIDIFile::devPeek(void)
+// Make sure the next record is in _devRec, false if there are none left
+{
+  uint8_t rec[MDEV_REC_SIZE];
+
+  if (_devPending)
+    return(true);
+
+  if (_devIndex >= _devRecords || _fd.read(rec, MDEV_REC_SIZE) != MDEV_REC_SIZE)
+  {
+    _devIndex = _devRecords;
+    return(false);
+  }
+
+  _devIndex++;
+  _devRec.tick = getLE32(&rec[0]);
+  _devRec.time = getLE32(&rec[4]);
+  _devRec.track = rec[8];
+  _devRec.status = rec[9];
+  _devRec.param = getLE16(&rec[10]);
+  _devPending = true;
+
+  return(true);
+}
+
+void MD_MIDIFile::devData(uint8_t *data, uint16_t size, uint16_t len)
+// Read the data for a SYSEX or META record, keeping only what fits
+{
+  uint8_t rec[MDEV_REC_SIZE];
+
+  for (uint32_t i = 0; i < len; i += MDEV_REC_SIZE)
+  {
+    if (_fd.read(rec, MDEV_REC_SIZE) != MDEV_REC_SIZE)
+      break;
+    _devIndex++;
+
+    for (uint8_t j = 0; j < MDEV_REC_SIZE && i + j < size; j++)
+      data[i + j] = rec[j];
+  }
+}
+
+void MD_MIDIFile::devDispatch(void)
+// Pass the pending record to the relevant callback
+{
+  _devPending = false;
+
+  DUMP("\nT: ", _devRec.tick);
+  DUMP(" us: ", _devRec.time);
+  DUMPS("\t");
+
+  if (_devRec.status < 0xf0)   // MIDI
+  {
+    midi_event ev;
+
+    ev.track = _devRec.track;
+    ev.channel = _devRec.status & 0xf;
+    ev.data[0] = _devRec.status & 0xf0;
+    ev.data[1] = _devRec.param & 0xff;
+    ev.data[2] = _devRec.param >> 8;
+    ev.size = (ev.data[0] == 0xc0 || ev.data[0] == 0xd0) ? 2 : 3;
+
+    DUMP("[MIDI] Ch: ", ev.channel);
+    DUMPX(" Data: ", ev.data[0]);
+    DUMPX(" ", ev.data[1]);
+    DUMPX(" ", ev.data[2]);
+#if !DUMP_DATA
+    dispatchMidi(&ev);
+#endif
+  }
+  else if (_devRec.status == 0xff)   // META
+  {
+    meta_event mev;
+    uint8_t data[MDEV_REC_SIZE + ARRAY_SIZE(mev.data)];   // type byte + data
+
+    devData(data, sizeof(data), _devRec.param);
+
+    mev.track = _devRec.track;
+    mev.type = data[0];
+    mev.size = _devRec.param - 1;
+    memcpy(mev.data, &data[1], ARRAY_SIZE(mev.data));
+    processMeta(&mev);
+  }
+#if !DUMP_DATA
+  else if (sysexChunked())          // SYSEX in chunks of one record
+  {
+    uint8_t rec[MDEV_REC_SIZE];
+    sysex_chunk ch;
+
+    ch.track = _devRec.track;
+    ch.status = _devRec.status;
+    ch.total = _devRec.param;
+    ch.offset = 0;
+    ch.data = rec;
+    ch.first = true;
+    do
+    {
+      ch.size = min((uint32_t)MDEV_REC_SIZE, ch.total - ch.offset);
+      if (ch.size != 0)
+      {
+        if (_fd.read(rec, MDEV_REC_SIZE) != MDEV_REC_SIZE)
+          ch.size = 0;
+        else
+          _devIndex++;
+      }
+      ch.last = (ch.size == 0) || (ch.offset + ch.size >= ch.total);
+      sendSysexChunk(&ch);
+      ch.offset += ch.size;
+      ch.first = false;
+    } while (!ch.last);
+  }
+#endif
+  else                              // SYSEX
+  {
+    sysex_event sev;
+    uint16_t index = 0;
+
+    sev.track = _devRec.track;
+    sev.size = _devRec.param;
+    if (_devRec.status == 0xf0)   // add space for 0xF0
+    {
+      sev.data[index++] = _devRec.status;
+      sev.size++;
+    }
+    devData(&sev.data[index], ARRAY_SIZE(sev.data) - index, _devRec.param);
+
+#if DUMP_DATA
+    DUMPS("[SYSX] Data:");
+    for (uint16_t i = 0; i < min(sev.size, (uint16_t)ARRAY_SIZE(sev.data)); i++)
+    {
+      DUMPX(" ", sev.data[i]);
+    }
+#else
+    dispatchSysex(&sev);
+#endif
+  }
+}
+
+bool MD_MIDIFile::devProcess(bool useTicks, uint32_t now)
+// Dispatch all the records due by now (ticks or microseconds)
+{
+  bool b = false;
+
+  while (devPeek() && ((useTicks ? _devRec.tick : _devRec.time) <= now))
+  {
+    devDispatch();
+    b = true;
+    if (!budgetLeft())
+      break;
+  }
+
+  return(b);
+}
@@ -21,6 +21,8 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
+#include <new>
 
 #include <FS.h>
 #include <SPIFFS.h>
@@ -32,21 +34,69 @@
  * \brief Main file for the MD_MIDIFile class implementation
  */
 
+// Transport command bits in _ctlPending. The loop and tempo commands change state
+// owned by the decoder task in pipeline mode, so it applies them itself.
+#define CTL_BIT(c)    (1 << (c))
+#define CTL_DECODER   (CTL_BIT(TRANSPORT_LOOP) | CTL_BIT(TRANSPORT_TEMPO_ADJUST))
+#define CTL_POSITION  (CTL_BIT(TRANSPORT_RESTART) | CTL_BIT(TRANSPORT_SEEK_TICK) | CTL_BIT(TRANSPORT_SEEK_MICROS))
+
 void MD_MIDIFile::initialise(void)
 {
   _trackCount = 0;            // number of tracks in file
+  _track = nullptr;
+  _trackDue = nullptr;
+  _heap = nullptr;
+  _heapCount = _trackAlloc = 0;
+  _trackOwned = false;
+  setTrackArena(nullptr, 0);
   _format = 0;
   _tickTime = _lastTickError = 0;
+  _tickTimeFP = 0;
+  _songRateFP = 1ULL << 32;
+  _songTimeNum = _playTime = _playTicks = 0;
+  _tickCount = 0;
   _synchDone = false;
   _paused =_looping = false;
+  setScheduler(TRACK_PRIORITY ? SCHED_TRACK : SCHED_EVENT);
   
   setMidiHandler(nullptr);
   setSysexHandler(nullptr);
+  setSysexChunkHandler(nullptr);
   setMetaHandler(nullptr);
+  setLatenessHandler(nullptr);
+  setMidiOutput(nullptr);
+  _window = nullptr;
+  _windowCount = _windowSize = 0;
+  _timerRunning = false;
+  _timerDueSet = false;
+  memset(&_timerStats, 0, sizeof(_timerStats));
+  _pipe = nullptr;
+  _ctlPending = 0;
+  memset(_activeNote, 0, sizeof(_activeNote));
+#if MIDI_TIMER_ESP32
+  _timer = nullptr;
+#elif MIDI_TIMER_POSIX
+  _timerJoin = false;
+#endif
 
   // File handling
   setFilename("");
   _sd = nullptr;
+  _image = _userBuf = nullptr;
+  _imageOwned = false;
+  setLoadMode(LOAD_STREAM);
+  _devMode = false;
+  _seeking = false;
+  _idxCount = 0;
+  _idxPoint = nullptr;
+  _idxTrack = nullptr;
+  _chaseMode = false;
+  setProcessBudget(0, 0);
+  _pending = false;
+  _resumeTrack = 0;
+  _tmapAuto = false;
+  _tmapCount = _tmapEndTick = 0;
+  _tmap = nullptr;
 
   // Set MIDI specified standard defaults
   setTicksPerQuarterNote(48); // 48 ticks per quarter note
@@ -58,11 +108,19 @@ void MD_MIDIFile::initialise(void)
 
 void MD_MIDIFile::synchTracks(void)
 {
-  for (uint8_t i = 0; i < _trackCount; i++)
+  for (uint8_t i = 0; i < _trackAlloc; i++)
     _track[i].syncTime();
 
+  _tickCount = 0;
+  _devTimeFP = 0;
+  _heapValid = false;   // due ticks have been rebased
+  _pending = false;
+  _resumeTrack = 0;
   _lastTickCheckTime = micros();
+  _windowTick = 0;
+  _windowTime = (uint64_t)_lastTickCheckTime << 32;
   _lastTickError = 0;
+  _songTimeNum = _playTime = _playTicks = 0;
 }
 
 MD_MIDIFile::MD_MIDIFile(void) 
@@ -83,16 +141,146 @@ void MD_MIDIFile::begin(SDFAT *psd)
 void MD_MIDIFile::close()
 // Close out - should be ready for the next file
 {
-  for (uint8_t i = 0; i<_trackCount; i++)
-  {
-    _track[i].close();
-  }
+  stopTimer();
+  stopPipeline();
+  _ctlPending = 0;
+  flushActiveNotes();
+
+  releaseTracks();
   _trackCount = 0;
+  _tickCount = 0;
+  _heapValid = false;
+  _devMode = false;
   _synchDone = false;
   _paused = false;
 
   setFilename("");
   _fd.close();
+  releaseMemory();
+  releaseIndex();
+  releaseTempoMap();
+}
+
+void MD_MIDIFile::setLoadMode(loadMode_t mode, uint32_t budget)
+{
+  _loadMode = mode;
+  _loadBudget = budget;
+}
+
+void MD_MIDIFile::setTrackArena(void *arena, uint32_t size)
+{
+  _arena = arena;
+  _arenaSize = (arena == nullptr) ? 0 : size;
+}
+
+int MD_MIDIFile::allocTracks(uint16_t count)
+// Make space for the tracks, their due ticks and their scheduler entries, 
+// from the arena if one is set, otherwise from the heap
+{
+  uint8_t *mem;
+
+  releaseTracks();
+  if (count > MIDI_MAX_TRACKS)
+    return(E_TRACKS);
+  if (count == 0)
+    return(E_OK);
+
+  if (_arena != nullptr)
+  {
+    uintptr_t align = ((uintptr_t)_arena + alignof(MD_MFTrack) - 1) & ~(uintptr_t)(alignof(MD_MFTrack) - 1);
+    uint32_t skip = align - (uintptr_t)_arena;
+
+    if (getTrackArenaSize(count) - (alignof(MD_MFTrack) - 1) + skip > _arenaSize)
+      return(E_TRACKS);
+    mem = (uint8_t *)align;
+  }
+  else if ((mem = (uint8_t *)malloc(count * (sizeof(MD_MFTrack) + sizeof(uint32_t) + sizeof(sched_entry)))) == nullptr)
+    return(E_NO_MEMORY);
+
+  _trackOwned = (_arena == nullptr);
+  _track = (MD_MFTrack *)mem;
+  _trackDue = (uint32_t *)(mem + (count * sizeof(MD_MFTrack)));
+  _heap = (sched_entry *)(mem + (count * (sizeof(MD_MFTrack) + sizeof(uint32_t))));
+  for (_trackAlloc = 0; _trackAlloc < count; _trackAlloc++)
+  {
+    new (&_track[_trackAlloc]) MD_MFTrack;
+    _track[_trackAlloc].setDueSlot(&_trackDue[_trackAlloc]);
+  }
+
+  return(E_OK);
+}
+
+void MD_MIDIFile::releaseTracks(void)
+{
+  for (uint8_t i = 0; i < _trackAlloc; i++)
+    _track[i].~MD_MFTrack();
+
+  if (_trackOwned)
+    free(_track);
+  _track = nullptr;
+  _trackDue = nullptr;
+  _heap = nullptr;
+  _heapCount = _trackAlloc = 0;
+  _trackCount = 0;      // no tracks to play until a file is loaded
+  _trackOwned = false;
+}
+
+void MD_MIDIFile::setLoadBuffer(uint8_t *buf, uint32_t size)
+{
+  _userBuf = buf;
+  setLoadMode(LOAD_BUFFER, (buf == nullptr) ? 0 : size);
+}
+
+void MD_MIDIFile::releaseMemory(void)
+{
+  if (_imageOwned)
+    free((void *)_image);
+  _image = nullptr;
+  _imageOwned = false;
+}
+
+bool MD_MIDIFile::loadMemory(void)
+// Read the whole file into memory and point all the tracks at the memory copy.
+// Return false if the file stays streamed from the file system.
+{
+  uint32_t size = _fd.size();
+  uint8_t *p = nullptr;
+
+  releaseMemory();
+
+  if (size == 0 || size > _loadBudget)
+    return(false);
+
+  switch (_loadMode)
+  {
+    case LOAD_RAM:    p = (uint8_t *)malloc(size); break;
+#ifdef ESP32
+    case LOAD_PSRAM:  p = (uint8_t *)ps_malloc(size); break;
+#endif
+    case LOAD_BUFFER: p = _userBuf; break;
+    default:          break;
+  }
+
+  if (p == nullptr)
+    return(false);
+
+  _fd.seek(0);
+  if (_fd.read(p, size) != size)
+  {
+    if (p != _userBuf) free(p);
+    return(false);
+  }
+
+  _image = p;
+  _imageOwned = (p != _userBuf);
+  for (uint8_t i = 0; i < _trackCount; i++)
+    _track[i].setMemory(_image, size);
+
+  // everything is in memory so the file is no longer needed
+  _fd.close();
+  DUMP("\nLoaded in memory: ", size);
+
+  return(true);
 }
 
 void MD_MIDIFile::setTempoAdjust(int16_t t)
@@ -103,7 +291,11 @@ void MD_MIDIFile::setTempoAdjust(int16_t t)
 
 void MD_MIDIFile::setTempo(uint16_t t)
 {
-  if ((_tempoDelta + t) > 0) _tempo = t;
+  if (t != 0 && (_tempoDelta + t) > 0) 
+  {
+    _tempo = t;
+    _usPerQN = (60 * 1000000L) / t;
+  }
   calcTickTime();
 }
 
@@ -125,7 +317,9 @@ void MD_MIDIFile::setMicrosecondPerQuarterNote(uint32_t m)
 {
   // work out the tempo from the delta by reversing the calcs in
   // calctickTime - m is already per quarter note
+  if (m == 0) return;
   _tempo = (60 * 1000000L) / m;
+  _usPerQN = m;   // keep the exact value for the tick time
   calcTickTime();
 }
 
@@ -136,12 +330,21 @@ void MD_MIDIFile::calcTickTime(void)
 // by default, which is equivalent to 120 beats per minute. 
 // If the MIDI time division is 60 ticks per beat and if the microseconds per beat 
 // is 500,000, then 1 tick = 500,000 / 60 = 8333.33 microseconds.
+// The tick time is kept in 32.32 fixed point so the fraction is not lost.
 {
-  if ((_tempo + _tempoDelta != 0) && _ticksPerQuarterNote != 0 && _timeSignature[1] != 0)
+  if ((_tempo + _tempoDelta != 0) && _ticksPerQuarterNote != 0 && _timeSignature[1] != 0 && _usPerQN != 0)
   {
-    _tickTime = (60 * 1000000L) / (_tempo + _tempoDelta); // microseconds per beat
+    // microseconds per beat, adjusted in proportion to the bpm adjustment
+    int64_t den = (60 * 1000000LL) + ((int64_t)_tempoDelta * _usPerQN);
+
+    if (den <= 0) return;
+    _usPerQNAdj = ((60 * 1000000ULL) * _usPerQN) / den;
 //    _tickTime = (_tickTime * 4) / (_timeSignature[1] * _ticksPerQuarterNote); // microseconds per tick
-    _tickTime /= _ticksPerQuarterNote;
+    _tickTimeFP = ((uint64_t)_usPerQNAdj << 32) / _ticksPerQuarterNote;
+    _tickTime = _tickTimeFP >> 32;
+    // compiled streams are timed in song microseconds, which run at this rate
+    _songRateFP = ((uint64_t)_usPerQN << 32) / _usPerQNAdj;
+    if (_songRateFP == 0) _songRateFP = 1;
   }
 }
 
@@ -149,10 +352,20 @@ bool MD_MIDIFile::isEOF(void)
 {
   bool bEof = true;
 
-  // check if each track has finished
-  for (uint8_t i=0; i<_trackCount && bEof; i++)
+#if MIDI_TIMER_ESP32 || MIDI_TIMER_POSIX
+  if (_pipe != nullptr)   // the decoder has finished and everything has been played
+    return(_pipeDone && _pipeTail == _pipeHead);
+#endif
+
+  if (_devMode)   // all records have been played
+    bEof = !devPeek();
+  else
   {
-    bEof = (_track[i].getEndOfTrack() && bEof);  // breaks at first false
+    // check if each track has finished
+    for (uint8_t i=0; i<_trackCount && bEof; i++)
+    {
+      bEof = (_trackDue[i] == UINT32_MAX);  // breaks at first false
+    }
   }
   
   if (bEof) DUMPS("\n! EOF");
@@ -170,6 +383,24 @@ bool MD_MIDIFile::isEOF(void)
 void MD_MIDIFile::pause(bool bMode)
 // Start pause when true and restart when false
 {
+  if (bMode && !_paused)
+  {
+    _pauseTime = micros();
+    flushActiveNotes();
+  }
+  else if (!bMode && _paused)   // events in the window or queue are later by the pause time
+  {
+#if MIDI_TIMER_ESP32 || MIDI_TIMER_POSIX
+    if (_pipe != nullptr)       // the clock belongs to the decoder task
+    {
+      _pipeShift += micros() - _pauseTime;
+      _paused = false;
+      return;
+    }
+#endif
+    _windowTime += (uint64_t)(micros() - _pauseTime) << 32;
+  }
+
   _paused = bMode;
 
   if (!_paused)         // restarting so adjust the time last checked to now
@@ -182,37 +413,336 @@ void MD_MIDIFile::restart(void)
   // track 0 contains information that does not need to be reloaded every time, 
   // so if we are looping, ignore restarting that track. The file may have one 
   // track only and in this case always sync from track 0.
-  for (uint8_t i=(_looping && _trackCount>1 ? 1 : 0); i<_trackCount; i++)
-    _track[i].restart();
+  if (_pipe == nullptr)    // not the pipeline decoder looping
+    flushActiveNotes();
+
+  if (_devMode)
+    devRestart();
+  else
+  {
+    for (uint8_t i=(_looping && _trackCount>1 ? 1 : 0); i<_trackCount; i++)
+      _track[i].restart();
+  }
+
+  _tickCount = 0;
+  _heapValid = false;
+  _pending = false;
+  _resumeTrack = 0;
 
   _synchDone = false;   // force a time resych as well
 }
 
+uint16_t MD_MIDIFile::flushActiveNotes(void)
+{
+  midi_event ev;
+  uint16_t count = 0;
+
+  ev.track = 0;
+  ev.size = 3;
+  ev.data[0] = 0x80;
+  ev.data[2] = 0;
+
+  for (uint8_t ch = 0; ch < ARRAY_SIZE(_activeNote); ch++)
+  {
+    ev.channel = ch;
+    for (uint8_t i = 0; i < ARRAY_SIZE(_activeNote[ch]); i++)
+    {
+      while (_activeNote[ch][i] != 0)
+      {
+        uint8_t bit = __builtin_ctz(_activeNote[ch][i]);
+
+        _activeNote[ch][i] &= ~(1UL << bit);
+        ev.data[1] = (i * 32) + bit;
+        if (_midiOut != nullptr) _midiOut->midi(&ev);
+        if (_midiHandler != nullptr) (_midiHandler)(&ev);
+        count++;
+      }
+    }
+  }
+  flushOutput();
+
+  return(count);
+}
+
+uint8_t MD_MIDIFile::prefetch(uint16_t low)
+{
+  uint8_t n = 0;
+
+  if (_devMode || _pipe != nullptr)
+    return(0);
+
+  // the tracks are in file order
+  for (uint8_t i = 0; i < _trackCount; i++)
+  {
+    if (_trackDue[i] != UINT32_MAX && _track[i].prefetch(this, low))
+      n++;
+  }
+
+  return(n);
+}
+
+void MD_MIDIFile::postTransport(transport_t cmd, int32_t value)
+{
+  // the value is visible before the bit that says it is waiting
+  _ctlValue[cmd].store(value, std::memory_order_relaxed);
+  _ctlPending.fetch_or(CTL_BIT(cmd), std::memory_order_release);
+}
+
+void MD_MIDIFile::applyTransport(bool decoder)
+// Take the commands waiting for this side and apply them in a fixed order
+{
+  uint8_t mask = decoder ? CTL_DECODER : ((_pipe != nullptr) ? (uint8_t)~CTL_DECODER : 0xff);
+  uint8_t cmd = _ctlPending.fetch_and(~mask, std::memory_order_acquire) & mask;
+  bool repipe = (_pipe != nullptr) && !decoder && (cmd & CTL_POSITION);
+
+  if (cmd == 0)
+    return;
+
+  if (repipe)   // the decoder owns the tracks, start again from the new position
+    stopPipeline();
+
+  if (cmd & CTL_BIT(TRANSPORT_RESTART))
+    restart();
+  if (cmd & CTL_BIT(TRANSPORT_SEEK_TICK))
+    seekToTick(_ctlValue[TRANSPORT_SEEK_TICK].load(std::memory_order_relaxed));
+  if (cmd & CTL_BIT(TRANSPORT_SEEK_MICROS))
+    seekToMicros(_ctlValue[TRANSPORT_SEEK_MICROS].load(std::memory_order_relaxed));
+  if (cmd & CTL_BIT(TRANSPORT_LOOP))
+    looping(_ctlValue[TRANSPORT_LOOP].load(std::memory_order_relaxed) != 0);
+  if (cmd & CTL_BIT(TRANSPORT_TEMPO_ADJUST))
+    setTempoAdjust(_ctlValue[TRANSPORT_TEMPO_ADJUST].load(std::memory_order_relaxed));
+
+  if (repipe)
+    startPipeline();
+
+  if (cmd & CTL_BIT(TRANSPORT_PAUSE))
+    pause(_ctlValue[TRANSPORT_PAUSE].load(std::memory_order_relaxed) != 0);
+}
+
 uint16_t MD_MIDIFile::tickClock(void)
 // check if enough time has passed for a MIDI tick and work out how many!
+// All the arithmetic is in 32.32 fixed point microseconds so that the 
+// fraction of each tick carries forward and the timing does not drift.
 {
-  uint32_t  elapsedTime;
-  uint16_t  ticks = 0;
+  uint32_t  now = micros();
+  uint64_t  elapsedTime;
+  uint64_t  ticks = 0;
 
-  elapsedTime = _lastTickError + micros() - _lastTickCheckTime;
-  if (elapsedTime >= _tickTime)
+  if (_tickTimeFP == 0)
+    return(0);
+
+  elapsedTime = _lastTickError + ((uint64_t)(now - _lastTickCheckTime) << 32);
+  if (elapsedTime >= _tickTimeFP)
   {
-    ticks = elapsedTime/_tickTime;
-    _lastTickError = elapsedTime - (_tickTime * ticks);
-    _lastTickCheckTime = micros();    // save for next round of checks
+    ticks = elapsedTime / _tickTimeFP;
+    if (ticks > UINT16_MAX) ticks = UINT16_MAX;   // any left over are counted next time
+    _lastTickError = elapsedTime - (_tickTimeFP * ticks);
+    _playTime += now - _lastTickCheckTime;
+    _playTicks += ticks;
+    _songTimeNum += ticks * _usPerQNAdj;
+    _lastTickCheckTime = now;    // save for next round of checks
   }
 
   return(ticks);
 }
 
+uint32_t MD_MIDIFile::getMicrosToNextEvent(void)
+{
+  uint32_t  now = micros();
+  uint64_t  wait, elapsed;
+
+  // getNextEvent() needs to apply the commands, but not those left for the decoder
+  if (_ctlPending.load(std::memory_order_relaxed) & ((_pipe != nullptr) ? (uint8_t)~CTL_DECODER : 0xff))
+    return(0);
+
+  if (_paused)
+    return(UINT32_MAX);
+
+#if MIDI_TIMER_ESP32 || MIDI_TIMER_POSIX
+  if (_pipe != nullptr)
+    return(pipeWait());
+#endif
+
+  if (!_synchDone || _pending)   // the clock starts at the next getNextEvent()
+    return(0);
+
+  if (_devMode)
+  {
+    if (!devPeek())
+      return(UINT32_MAX);
+
+    // compiled stream time runs faster or slower with the tempo adjustment
+    elapsed = _devTimeFP + ((uint64_t)(now - _lastTickCheckTime) * _songRateFP);
+    wait = (uint64_t)_devRec.time << 32;
+    if (wait <= elapsed)
+      return(0);
+
+    wait = ((wait - elapsed) + _songRateFP - 1) / _songRateFP;   // rounded up
+  }
+  else
+  {
+    uint32_t next = ((_scheduler == SCHED_TIME) && _heapValid) ?
+      ((_heapCount == 0) ? UINT32_MAX : _heap[0].due) : nextDueTick();
+
+    if (next == UINT32_MAX)
+      return(UINT32_MAX);
+    if (_tickTimeFP == 0)
+      return(0);
+
+    // events are only processed when at least one more tick has passed
+    if (next <= _tickCount)
+      next = _tickCount + 1;
+
+    // ticks still to go less the part tick already counted, in 32.32 fixed point
+    if ((next - _tickCount) > (UINT64_MAX / _tickTimeFP))
+      return(UINT32_MAX);
+    wait = (next - _tickCount) * _tickTimeFP;
+    elapsed = _lastTickError + ((uint64_t)(now - _lastTickCheckTime) << 32);
+    if (wait <= elapsed)
+      return(0);
+
+    wait = ((wait - elapsed) + 0xffffffffULL) >> 32;  // round up to whole microseconds
+  }
+
+  return(wait > UINT32_MAX ? UINT32_MAX : (uint32_t)wait);
+}
+
+uint16_t MD_MIDIFile::getEventWindow(uint32_t windowMs, timed_event *buf, uint16_t size)
+{
+  if (_paused || _devMode || buf == nullptr)
+    return(0);
+
+  // sync start all the tracks if we need to
+  if (!_synchDone)
+  {
+    synchTracks();
+    _synchDone = true;
+  }
+
+  return(fillWindow(micros() + (windowMs * 1000), buf, size));
+}
+
+uint16_t MD_MIDIFile::fillWindow(uint32_t horizon, timed_event *buf, uint16_t size)
+{
+  _window = buf;
+  _windowSize = size;
+  _windowCount = 0;
+
+  // read events in time order until the window or the buffer is full
+  while (_windowCount < _windowSize)
+  {
+    uint32_t next = nextDueTick();
+    uint64_t t;
+
+    if (next == UINT32_MAX)
+      break;
+
+    // time of the next event at the tempo in effect since the last one
+    t = _windowTime + ((uint64_t)(next - _windowTick) * _tickTimeFP);
+    if ((int32_t)((uint32_t)(t >> 32) - horizon) > 0)
+      break;
+
+    _windowTime = t;
+    _windowTick = _tickCount = next;
+
+    // one event only from the first track with the earliest event
+    for (uint8_t i = 0; i < _trackCount; i++)
+    {
+      if (_trackDue[i] == next)
+      {
+        _track[i].getNextEvent(this);
+        break;
+      }
+    }
+  }
+
+  _window = nullptr;
+  _heapValid = false;
+
+  return(_windowCount);
+}
+
+void MD_MIDIFile::dispatchMidi(midi_event *pev)
+{
+  if (_seeking)
+  {
+    if (_chaseMode)
+      chaseEvent(pev);
+    return;
+  }
+
+  if (_window != nullptr)
+  {
+    timed_event *te = &_window[_windowCount++];
+
+    te->time = _windowTime >> 32;
+    te->tick = _windowTick;
+    te->type = TIMED_MIDI;
+    te->midi = *pev;
+  }
+  else
+    sendMidi(pev);
+}
+
+void MD_MIDIFile::dispatchSysex(sysex_event *pev)
+{
+  if (_seeking)
+    return;
+
+  if (_window != nullptr)
+  {
+    timed_event *te = &_window[_windowCount++];
+
+    te->time = _windowTime >> 32;
+    te->tick = _windowTick;
+    te->type = TIMED_SYSEX;
+    te->sysex = *pev;
+  }
+  else
+    sendSysex(pev);
+}
+
+void MD_MIDIFile::sendSysex(sysex_event *pev)
+{
+  if (_midiOut != nullptr) _midiOut->sysex(pev);
+  if (_sysexHandler != nullptr) (_sysexHandler)(pev);
+}
+
+void MD_MIDIFile::sendSysexChunk(const sysex_chunk *pch)
+{
+  if (_midiOut != nullptr) _midiOut->sysexChunk(pch);
+  if (_sysexChunkHandler != nullptr) (_sysexChunkHandler)(pch);
+}
+
+void MD_MIDIFile::getTimingReport(timing_report *r)
+{
+  uint32_t pending = _lastTickError >> 32;
+  uint32_t song = (_ticksPerQuarterNote == 0) ? 0 : _songTimeNum / _ticksPerQuarterNote;
+
+  r->ticks = _playTicks;
+  r->elapsed = _playTime;
+  r->songTime = song;
+  r->drift = (int32_t)(_playTime - song - pending);
+}
+
 boolean MD_MIDIFile::getNextEvent(void)
 {
   uint16_t  ticks;
 
+  // commands from other tasks are applied here
+  if (_ctlPending.load(std::memory_order_relaxed) != 0)
+    applyTransport(false);
+
   // if we are paused we are paused!
   if (_paused) 
     return false;
 
+#if MIDI_TIMER_ESP32 || MIDI_TIMER_POSIX
+  // the decoder task has done the work already
+  if (_pipe != nullptr)
+    return(pipeDispatch());
+#endif
+
   // sync start all the tracks if we need to
   if (!_synchDone)
   {
@@ -220,8 +750,25 @@ boolean MD_MIDIFile::getNextEvent(void)
     _synchDone = true;
   }
 
-  // check if enough time has passed for a MIDI tick
-  if ((ticks = tickClock()) == 0)
+  // compiled event streams are timed directly in microseconds
+  if (_devMode)
+  {
+    uint32_t now = micros();
+    bool b;
+
+    // scale for the tempo adjustment, keeping the fraction for the next call
+    _devTimeFP += (uint64_t)(now - _lastTickCheckTime) * _songRateFP;
+    _lastTickCheckTime = now;
+
+    budgetStart();
+    b = devProcess(false, _devTimeFP >> 32);
+    flushOutput();
+    return(b);
+  }
+
+  // check if enough time has passed for a MIDI tick, 
+  // carrying on with any events left by the last call
+  if ((ticks = tickClock()) == 0 && !_pending)
     return false;
 
   processEvents(ticks);
@@ -229,9 +776,44 @@ boolean MD_MIDIFile::getNextEvent(void)
   return(true);
 }
 
-void MD_MIDIFile::processEvents(uint16_t ticks)
+void MD_MIDIFile::setProcessBudget(uint16_t events, uint32_t us)
 {
-  uint8_t n;
+  _budgetEvents = events;
+  _budgetMicros = us;
+}
+
+void MD_MIDIFile::budgetStart(void)
+{
+  _budgetUsed = 0;
+  _budgetStart = micros();
+  _pending = false;
+}
+
+bool MD_MIDIFile::budgetLeft(void)
+// Count an event processed and check if there is budget for another one
+{
+  _budgetUsed++;
+  if ((_budgetEvents != 0 && _budgetUsed >= _budgetEvents) ||
+    (_budgetMicros != 0 && (micros() - _budgetStart) >= _budgetMicros))
+  {
+    _pending = true;
+    return(false);
+  }
+
+  return(true);
+}
+
+bool MD_MIDIFile::processEvents(uint16_t ticks)
+{
+  _tickCount += ticks;
+  budgetStart();
+
+  if (_devMode)
+  {
+    devProcess(true, _tickCount);
+    flushOutput();
+    return(_pending);
+  }
 
   if (_format != 0) 
   {
@@ -239,126 +821,339 @@ void MD_MIDIFile::processEvents(uint16_t ticks)
     DUMPS("] TRK "); 
   }
 
-#if TRACK_PRIORITY
-  // process all events from each track first - TRACK PRIORITY
+  // Work left over when the budget runs out is resumed from the track that was 
+  // interrupted (_resumeTrack) at the next call, so all the tracks get a turn.
+  switch (_scheduler)
+  {
+  case SCHED_TRACK:
+    // process all events from each track first - TRACK PRIORITY
+    for (uint8_t n = 0; n < _trackCount && !_pending; n++)
+    {
+      uint8_t i = (_resumeTrack + n) % _trackCount;
+      bool b = false;
+
+      if (_trackDue[i] > _tickCount)   // nothing due, or ended
+        continue;
+
+      if (_format != 0) DUMPX("", i);
+      // When there are no more events, just break out
+      while (_track[i].getNextEvent(this))
+      {
+        b = true;
+        if (!budgetLeft())
+        {
+          _resumeTrack = i;
+          break;
+        }
+      }
+
+      if (b && (_format != 0))
+        DUMPS("\n-- TRK "); 
+    }
+    break;
+
+  case SCHED_EVENT:
+  {
+    // process one event from each track round-robin style - EVENT PRIORITY
+    bool doneEvents;
+
+    do
+    {
+      doneEvents = false;
+
+      for (uint8_t n = 0; n < _trackCount && !_pending; n++) // cycle through all
+      {
+        uint8_t i = (_resumeTrack + n) % _trackCount;
+        bool b;
+
+        if (_trackDue[i] > _tickCount)   // nothing due, or ended
+          continue;
+
+        if (_format != 0) DUMPX("", i);
+
+        b = _track[i].getNextEvent(this);
+        if (b && (_format != 0))
+          DUMPS("\n-- TRK "); 
+        doneEvents = (doneEvents || b);
+
+        if (b && !budgetLeft())
+          _resumeTrack = (i + 1) % _trackCount;
+      }
+
+      // When there are no more events, just break out
+    } while (doneEvents && !_pending);
+  }
+  break;
+
+  case SCHED_TIME:
+    // process the earliest event from any track until none are due - TIME ORDER
+    processTimeOrder();
+    break;
+  }
+
+  if (!_pending)
+    _resumeTrack = 0;
+  flushOutput();
+
+  return(_pending);
+}
+
+void MD_MIDIFile::setScheduler(scheduler_t mode)
+{
+  _scheduler = mode;
+  _heapValid = false;
+}
+
+void MD_MIDIFile::heapDown(uint8_t pos)
+// Move the entry at pos down the heap until it is in order. 
+// Entries are ordered on the due tick and then the track index.
+{
+  while (true)
+  {
+    uint8_t least = pos;
+    uint16_t child = (2 * pos) + 1;
+
+    for (uint16_t c = child; c < child + 2 && c < _heapCount; c++)
+    {
+      if ((_heap[c].due < _heap[least].due) ||
+        ((_heap[c].due == _heap[least].due) && (_heap[c].track < _heap[least].track)))
+        least = c;
+    }
+
+    if (least == pos)
+      break;
+
+    sched_entry tmp = _heap[pos];
+    _heap[pos] = _heap[least];
+    _heap[least] = tmp;
+    pos = least;
+  }
+}
+
+void MD_MIDIFile::heapBuild(void)
+// Put all the tracks with events left into the heap
+{
+  _heapCount = 0;
   for (uint8_t i = 0; i < _trackCount; i++)
   {
-    if (_format != 0) DUMPX("", i);
-    // Limit n to be a sensible number of events in the loop counter
-    // When there are no more events, just break out
-    // Other than the first event, the others have an elapsed time of 0 (ie occur simultaneously)
-    for (n=0; n < 100; n++)
+    uint32_t due = _track[i].getDueTick(this);
+
+    if (!_track[i].getEndOfTrack())
     {
-      if (!_track[i].getNextEvent(this, (n==0 ? ticks : 0)))
-        break;
+      _heap[_heapCount].due = due;
+      _heap[_heapCount].track = i;
+      _heapCount++;
     }
+  }
+
+  for (int16_t pos = (_heapCount / 2) - 1; pos >= 0; pos--)
+    heapDown(pos);
+
+  _heapValid = true;
+}
+
+void MD_MIDIFile::processTimeOrder(void)
+// Process events from the track at the top of the heap while they are due
+{
+  if (!_heapValid)
+    heapBuild();
+
+  while ((_heapCount > 0) && (_heap[0].due <= _tickCount))
+  {
+    uint8_t i = _heap[0].track;
+    uint32_t due;
+
+    if (_format != 0) DUMPX("", i);
+    _track[i].getNextEvent(this);
+    due = _track[i].getDueTick(this);
 
-    if ((n > 0) && (_format != 0))
-      DUMPS("\n-- TRK "); 
+    if (_track[i].getEndOfTrack())  // take it out of the heap
+      _heap[0] = _heap[--_heapCount];
+    else
+      _heap[0].due = due;
+
+    heapDown(0);
+
+    if (!budgetLeft())
+      break;
   }
-#else // EVENT_PRIORITY
-  // process one event from each track round-robin style - EVENT PRIORITY
-  bool doneEvents;
+}
+
+void MD_MIDIFile::processMeta(meta_event *mev)
+// Act on the META event data and pass it to the callback
+{
+  uint16_t minLen = min((uint16_t)ARRAY_SIZE(mev->data), mev->size);
 
-  // Limit n to be a sensible number of events in the loop counter
-  for (n = 0; (n < 100) && (!doneEvents); n++)
+  DUMPX("[META] Type: 0x", mev->type);
+  DUMP("\tLen: ", mev->size);
+  DUMPS("\t");
+
+  switch (mev->type)
   {
-    doneEvents = false;
+    case 0x2f:  // End of track
+      DUMPS("END OF TRACK");
+      break;
 
-    for (uint8_t i = 0; i < _trackCount; i++) // cycle through all
+    case 0x51:  // set Tempo - really the microseconds per tick
     {
-      bool b;
+      uint32_t value = ((uint32_t)mev->data[0] << 16) + ((uint32_t)mev->data[1] << 8) + mev->data[2];
 
-      if (_format != 0) DUMPX("", i);
+      setMicrosecondPerQuarterNote(value);
 
-      // Other than the first event, the other have an elapsed time of 0 (ie occur simultaneously)
-      b = _track[i].getNextEvent(this, (n==0 ? ticks : 0));
-      if (b && (_format != 0))
-        DUMPS("\n-- TRK "); 
-      doneEvents = (doneEvents || b);
+      DUMP("SET TEMPO to ", getTickTime());
+      DUMP(" us/tick or ", getTempo());
+      DUMPS(" beats/min");
     }
+    break;
 
-    // When there are no more events, just break out
-    if (!doneEvents)
+    case 0x58:  // time signature
+    {
+      setTimeSignature(mev->data[0], 1 << mev->data[1]);  // denominator is 2^n
+
+      mev->data[2] = 0;
+      mev->data[3] = 0;
+
+      DUMP("SET TIME SIGNATURE to ", getTimeSignature() >> 8);
+      DUMP("/", getTimeSignature() & 0xf);
+    }
+    break;
+
+    case 0x59:  // Key Signature
+    {
+      DUMPS("KEY SIGNATURE");
+      int8_t sf = mev->data[0];
+      uint8_t mi = mev->data[1];
+      static const char* aaa[] = {"Cb", "Gb", "Db", "Ab", "Eb", "Bb", "F", "C", "G", "D", "A", "E", "B", "F#", "C#", "G#", "D#", "A#"};
+
+      if (sf >= -7 && sf <= 7) 
+      {
+        switch(mi)
+        {
+          case 0:
+            strcpy(mev->chars, aaa[sf+7]);
+            strcat(mev->chars, "M");
+            break;
+          case 1:
+            strcpy(mev->chars, aaa[sf+10]);
+            strcat(mev->chars, "m");
+            break;
+          default:
+            strcpy(mev->chars, "Err"); // error mi
+        }
+      } else
+        strcpy(mev->chars, "Err"); // error sf
+
+      mev->size = strlen(mev->chars); // change META length
+      DUMP(" ", mev->chars);
+    }
+    break;
+
+    case 0x00:  // Sequence Number
+      DUMP("SEQUENCE NUMBER ", mev->data[0]);
+      DUMP(" ", mev->data[1]);
       break;
-  } 
-#endif // EVENT/TRACK_PRIORITY
+
+    case 0x20:  // Channel Prefix
+      DUMP("CHANNEL PREFIX ", mev->data[0]);
+      break;
+
+    case 0x21:  // Port Prefix
+      DUMP("PORT PREFIX ", mev->data[0]);
+      break;
+
+#if SHOW_UNUSED_META
+    case 0x01:  // Text
+    case 0x02:  // Copyright Notice
+    case 0x03:  // Sequence or Track Name
+    case 0x04:  // Instrument Name
+    case 0x05:  // Lyric
+    case 0x06:  // Marker
+    case 0x07:  // Cue Point
+    {
+      static const char* label[] = { "TEXT ", "COPYRIGHT ", "SEQ/TRK NAME ", "INSTRUMENT ", "LYRIC ", "MARKER ", "CUE POINT " };
+
+      DUMP("", label[mev->type - 1]);
+      for (uint16_t i=0; i<minLen; i++)
+        DUMP("", mev->chars[i]);
+      if (minLen < ARRAY_SIZE(mev->chars))
+        mev->chars[minLen] = '\0'; // in case it is a string
+    }
+    break;
+
+    case 0x54:  // SMPTE Offset
+      DUMPS("SMPTE OFFSET");
+      for (uint16_t i=0; i<minLen; i++)
+        DUMP(" ", mev->data[i]);
+      break;
+
+    case 0x7F:  // Sequencer Specific Metadata
+      DUMPS("SEQ SPECIFIC");
+      for (uint16_t i=0; i<minLen; i++)
+        DUMPX(" ", mev->data[i]);
+      break;
+#endif // SHOW_UNUSED_META
+
+    default:
+      if (minLen < ARRAY_SIZE(mev->chars))
+        mev->chars[minLen] = '\0'; // in case it is a string
+  //    DUMPS("IGNORED");
+      break;
+  }
+
+  if ((_metaHandler != nullptr) && !_seeking)
+    (_metaHandler)(mev);
 }
 
-int MD_MIDIFile::load(const char *fname) 
-// Load the MIDI file into memory ready for processing
+template <class S> int MD_MIDIFile::loadChunks(S *src)
+// Read the header and track chunks from the source
 // Return one of the E_* error codes
 {
   uint32_t dat32;
   uint16_t dat16;
 
-  _fileName = fname;
-  
-  if ((_fileName == nullptr) || (*_fileName == '\0'))
-    return(E_NO_FILE);
-
-  // open the file for reading
-  _fd = SPIFFS.open(_fileName, "r");
-  if (!_fd) 
-    return(E_NO_OPEN);
+  _heapValid = false;
 
   // Read the MIDI header
   // header chunk = "MThd" + <header_length:4> + <format:2> + <num_tracks:2> + <time_division:2>
   {
     char    h[MTHD_HDR_SIZE+1]; // Header characters + nul
 
-    _fd.readBytes(h, MTHD_HDR_SIZE+1);
+    src->read((uint8_t *)h, MTHD_HDR_SIZE);
     h[MTHD_HDR_SIZE] = '\0';
 
-
     if (strcmp(h, MTHD_HDR) != 0)
-    {
-      _fd.close();
       return(E_NOT_MIDI);
-    }
   }
 
-
-
-//WATCHOUT ZAC IS TRYING SOME SHIT WITH THE SEEKING TO BUMP THE POINTER UP A BYTE
-  _fd.seek(-1, SeekCur);
-
   // read header size
-  dat32 = readMultiByte(&_fd, MB_LONG);
+  dat32 = readMultiByte(src, MB_LONG);
   if (dat32 != 6)   // must be 6 for this header
   {
-    _fd.close();
-    Serial.println(dat32);
-
+    DUMP("\nHeader size: ", dat32);
     return(E_HEADER);
   }
   
   // read file type
-  dat16 = readMultiByte(&_fd, MB_WORD);
+  dat16 = readMultiByte(src, MB_WORD);
   if ((dat16 != 0) && (dat16 != 1))
-  {
-    _fd.close();
     return(E_FORMAT);
-  }
   _format = dat16;
  
   // read number of tracks
-  dat16 = readMultiByte(&_fd, MB_WORD);
+  dat16 = readMultiByte(src, MB_WORD);
 
   if ((_format == 0) && (dat16 != 1)) 
-  {
-    _fd.close();
     return(E_FORMAT0);
-  }
-  if (dat16 > MIDI_MAX_TRACKS)
   {
-    _fd.close();
-    return(E_TRACKS);
+    int err;
+
+    if ((err = allocTracks(dat16)) != E_OK)
+      return(err);
   }
   _trackCount = dat16;
 
   // read ticks per quarter note
-  dat16 = readMultiByte(&_fd, MB_WORD);
+  dat16 = readMultiByte(src, MB_WORD);
   if (dat16 & 0x8000) // top bit set is SMTE format
   {
     int framespersecond = (dat16 >> 8) & 0x00ff;
@@ -370,7 +1165,7 @@ int MD_MIDIFile::load(const char *fname)
       case 231:  framespersecond = 25; break;
       case 227:  framespersecond = 29; break;
       case 226:  framespersecond = 30; break;
-      default:   _fd.close(); return(7);
+      default:   return(7);
     }
     dat16 = framespersecond * resolution;
   } 
@@ -383,12 +1178,91 @@ int MD_MIDIFile::load(const char *fname)
   {
     int err;
 
-    if ((err = _track[i].load(i, this)) != -1)
-    {
-      _fd.close();
+    if ((err = _track[i].load(i, src)) != -1)
       return((10*(i+1))+err);
+  }
+
+  return(E_OK);
+}
+
+int MD_MIDIFile::load(const char *fname) 
+// Load the MIDI file into memory ready for processing
+// Return one of the E_* error codes
+{
+  int err;
+
+  _fileName = fname;
+  releaseMemory();
+  releaseIndex();
+  releaseTempoMap();
+  _devMode = false;
+  
+  if ((_fileName == nullptr) || (*_fileName == '\0'))
+    return(E_NO_FILE);
+
+  // open the file for reading
+  if (!_fd.open(_fileName))
+    return(E_NO_OPEN);
+
+  // a compiled event stream is played directly
+  {
+    char    h[MTHD_HDR_SIZE+1]; // Header characters + nul
+
+    _fd.read((uint8_t *)h, MTHD_HDR_SIZE);
+    h[MTHD_HDR_SIZE] = '\0';
+    _fd.seek(0);
+
+    if (strcmp(h, MDEV_HDR) == 0)
+    {
+      if ((err = loadDev()) != E_OK)
+        _fd.close();
+      return(err);
     }
-   }
+  }
+
+  if ((err = loadChunks(&_fd)) != E_OK)
+  {
+    _fd.close();
+    return(err);
+  }
+
+  // if required, play from memory instead of the file
+  if (_loadMode != LOAD_STREAM)
+    loadMemory();
+
+  if (_tmapAuto)
+    buildTempoMap();
+
+  return(E_OK);
+}
+
+int MD_MIDIFile::load(const uint8_t *image, uint32_t size)
+// Load the MIDI file from an image already in memory
+// Return one of the E_* error codes
+{
+  MD_MFSourceMem src;
+  int err;
+
+  setFilename("");
+  releaseMemory();
+  releaseIndex();
+  releaseTempoMap();
+  _fd.close();
+  _devMode = false;
+
+  if (!src.open(image, size) || size == 0)
+    return(E_NO_FILE);
+
+  if ((err = loadChunks(&src)) != E_OK)
+    return(err);
+
+  // play all the tracks directly from the image
+  _image = image;
+  for (uint8_t i = 0; i < _trackCount; i++)
+    _track[i].setMemory(_image, size);
+
+  if (_tmapAuto)
+    buildTempoMap();
 
   return(E_OK);
 }
@@ -406,7 +1280,7 @@ void MD_MIDIFile::dump(void)
   DUMP("/", getTimeSignature() & 0xf);
   DUMPS("\n");
  
-  for (uint8_t i=0; i<_trackCount; i++)
+  for (uint8_t i=0; i<_trackAlloc; i++)
   {
     _track[i].dump();
     DUMPS("\n");
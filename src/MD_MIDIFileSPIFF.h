@@ -27,9 +27,64 @@ Topics
 - \subpage pageTiming
 - \subpage pageHardware
 - \subpage pageLibrary
+- \subpage pageCompiled
 
 Revision History
 ----------------
+Oct 2026 version 2.7.0
+- Added per-track read-ahead buffers (MIDI_TRACK_BUFFER_SIZE) so track events are decoded 
+  from RAM and the file is only accessed with bulk reads.
+- Tracks decode the delta time of the next event once and keep the absolute tick it is 
+  due, so tracks with nothing to do are skipped without reading track data.
+- Added setLoadMode() and setLoadBuffer() to optionally play the whole SMF from RAM, PSRAM
+  or a user buffer.
+- Added byte source classes (MD_MIDISource.h) for SPIFFS, memory and POSIX files. 
+  readVarLen() and readMultiByte() are templates on the source type and MIDI_FILE_SOURCE 
+  selects the source used by load().
+- Added load() from an SMF image already in memory or flash.
+- Added compile() and loadCompiled() to convert an SMF into a compiled event stream 
+  file that is played without any SMF parsing.
+- Added buildIndex(), seekToTick() and seekToMicros() to jump to a song position using 
+  an optional index of track checkpoints, which can be saved next to the SMF.
+- Added setScheduler() to select the event order at run time, including strict time 
+  order (SCHED_TIME) using a priority queue of the tracks.
+- Added startTimer() and stopTimer() for timer driven playback (esp_timer or a POSIX 
+  thread), with lateness reporting.
+- Added getMicrosToNextEvent() so applications can sleep until the next event is due.
+- Added getEventWindow() to read the events due in the next time window in advance, 
+  with the time each is due, for buffered output.
+- The tick clock keeps the tick time in 32.32 fixed point from the exact tempo in the
+  SMF, so playback no longer drifts. Added getTimingReport() and getMicrosecondPerQuarterNote().
+- Added an optional tempo map built by load() (setTempoMap()) or buildTempoMap(), with 
+  getDurationMicros(), tickToMicros() and microsToTick() to convert song positions.
+- Added setChaseMode() so seekToTick() and seekToMicros() collect the program, bank, 
+  volume, pan, sustain and pitch bend of each channel and send them at the new position.
+- Added setProcessBudget() to limit the events or time spent in each processEvents() call, 
+  in place of the fixed 100 events for each track. processEvents() reports if work is left 
+  over and it is resumed fairly across the tracks at the next call.
+- Added setSysexChunkHandler() to pass SYSEX events of any size in chunks that point
+  directly into the track buffer, instead of truncating them to the sysex_event data.
+- The track data is allocated by load() for the number of tracks in the file, from the 
+  heap or an arena set with setTrackArena(), instead of a fixed array of MIDI_MAX_TRACKS.
+- Each track publishes the tick its next event is due into a compact array, so checking 
+  which tracks have work to do (and isEOF()) scans the array instead of the track objects.
+- Track events are decoded using a table of status byte classes, with a single fast path 
+  for MIDI messages and running status and the SYSEX and META events handled separately.
+- getTrackArenaSize() is constexpr, so the track memory of each player can be sized at 
+  compile time.
+- Added a host (Linux) CMake build in extras/host with an Arduino/SPIFFS shim and the 
+  MD_MIDIBench benchmark suite.
+- Added startPipeline() and stopPipeline() to decode the SMF ahead of playback in a 
+  separate task (another core on the ESP32), through a lock-free event queue.
+- Added postTransport() so pause, restart, looping, tempo and seek commands can be sent
+  from any task and are applied by the playback task without locking.
+- Added MD_MIDIGroup to play several MD_MIDIFile objects from one loop with shared, 
+  batched file reads (prefetch()) and a shared processing budget.
+- Added a table of the notes sounding, with flushActiveNotes() to turn only those notes 
+  off. This is done automatically on pause, restart, seek and close.
+- Added MD_MIDIOut to encode the events into the bytes sent on a MIDI port, with outgoing 
+  running status and one write() for each call to getNextEvent() (setMidiOutput()).
+
 Apr 2022 version 2.6.0
 - Changes file referencing from SdFat only to FAT16/FAT32/exFAT using SD_FAT_TYPE define.
 - Adjusted examples for SDFat library version 2 changes/deprecated methods.
@@ -343,6 +398,143 @@ _NOTE_: Compile switches must be edited in the library header file. Arduino head
 'mashing' during compilation makes the setting of these switches from user code
 completely unreliable.
 
+Per Object Configuration
+------------------------
+The settings that affect playback can be chosen for each MD_MIDIFile object instead,
+so differently configured players can be used in the same application:
+- the number of tracks and where their memory comes from - MD_MIDIFile::setTrackArena(),
+- the event order - MD_MIDIFile::setScheduler(),
+- where the SMF data comes from - MD_MIDIFile::setLoadMode() or load() from a memory image.
+
+The track memory can be sized at compile time, so no memory is allocated when a file 
+is loaded and files with more tracks are rejected with E_TRACKS:
+
+    alignas(MD_MFTrack) static uint8_t ringtoneTracks[MD_MIDIFile::getTrackArenaSize(1)];
+    MD_MIDIFile ringtone;
+
+    ringtone.setTrackArena(ringtoneTracks, sizeof(ringtoneTracks));  // type 0 files only
+
+The compile switches DUMP_DATA, SHOW_UNUSED_META, MIDI_MAX_TRACKS and TRACK_PRIORITY, 
+and the MIDI_FILE_SOURCE byte source, are not per object. They apply to every 
+MD_MIDIFile in the application and there is no template or policy form of them. 
+MIDI_MAX_TRACKS is only the upper limit for setTrackArena(), and TRACK_PRIORITY is 
+only the default for setScheduler().
+
+Playing Several Files
+---------------------
+Each MD_MIDIFile object plays one file, and several objects can play at the same time 
+(eg, a backing track with a click or cue track, or independent songs on different 
+outputs). MD_MIDIGroup plays them together from one loop:
+
+    MD_MIDIFile backing, click;
+    MD_MIDIGroup group;
+
+    group.add(&backing);
+    group.add(&click);
+    group.setProcessBudget(32, 1000); // no more than 32 events or 1 ms per call
+    ...
+    group.getNextEvent();             // in loop()
+
+The group schedules the file reads for all the players. Each track normally reads its
+data when its buffer runs dry, in the middle of processing events, so the reads of 
+different players (and tracks) are interleaved with the callbacks and with each other. 
+The group first tops up every buffer that is running low (MD_MIDIFile::prefetch()), 
+player by player and in file order within each player, then processes the events due. 
+
+The work done in each call is bounded: at most one read of MIDI_TRACK_BUFFER_SIZE bytes 
+for each track of each player, then the events allowed by the group budget, which is 
+shared equally between the players. Topping up when a buffer has fewer bytes left than 
+the events of one call use means the tracks do not need to read from the file while
+events are processed.
+
+MIDI Output
+-----------
+Sending the MIDI events to a serial MIDI port only needs an MD_MIDIOut object in place 
+of the MIDI callback:
+
+    MD_MIDIOut MIDIOut(Serial);       // any Print object
+
+    Serial.begin(31250);
+    SMF.setMidiOutput(&MIDIOut);
+
+MD_MIDIOut builds the bytes for each event in a buffer of MIDI_OUT_BUFFER_SIZE bytes 
+and the library writes them to the port with one write() call after each getNextEvent(),
+so all the events due at a tick go out together. The status byte is only sent when it 
+changes (outgoing running status), which saves a third of the bytes, and so of the time 
+on the wire, for a run of note messages on one channel. setNoteOffAsNoteOn() sends note 
+off as note on with velocity 0 so they share the running status too.
+
+SYSEX events of any size are sent in chunks when there is no SYSEX callback. The MIDI 
+and SYSEX callbacks can still be set (eg, for a display) and are called as well.
+
+Host Build and Benchmarks
+-------------------------
+The library can also be built on a Linux (POSIX) host, outside the Arduino toolchain, 
+to profile and measure it. extras/host contains a CMake project that compiles the library 
+against a small shim for the Arduino core, File and SPIFFS, and the MD_MIDIBench benchmark:
+
+    cmake -S extras/host -B build && cmake --build build
+    cd build && ./MD_MIDIBench [file.mid ...]
+
+MD_MIDIBench plays a set of synthetic SMF (written to the current folder) and any files 
+named on the command line, and reports for each one the load() time, the events decoded 
+per second streamed from the file and from a memory image, and the bytes read, read() 
+calls and seeks made per event. These are the baseline for performance changes.
+
+MD_MIDICheck runs functional checks against small SMF built in memory (eg, event windows 
+after a seek) and is run by `ctest --test-dir build`.
+
+\page pageCompiled Compiled Event Stream Files
+
+An SMF needs to be parsed while it is played. Delta times and running status are decoded 
+and, for type 1 files, all the tracks are read concurrently from different parts of the 
+file. compile() does this work once and writes the result to a compiled event stream 
+file (by convention with a .mdev extension). When a compiled file is passed to load() 
+it is recognised from its header and played directly.
+
+The compiled file contains all the events from all the tracks, merged in time order. Events 
+at the same tick are kept in track order. Every event has its absolute tick and its absolute 
+time in microseconds, calculated from the tempo changes in the file, so getNextEvent() simply 
+compares the time of the next record to the elapsed time. The tempo adjustment set through 
+setTempoAdjust() is applied to the elapsed time. When processEvents() is used the ticks are 
+used instead.
+
+File Format
+-----------
+All values are little endian. The file starts with a 32 byte header:
+
+| Offset | Size | Contents
+|--------|------|----------------------------------------------------------
+| 0      | 4    | "MDev"
+| 4      | 2    | format version (1)
+| 6      | 2    | ticks per quarter note
+| 8      | 4    | number of 12 byte records following the header
+| 12     | 4    | number of events
+| 16     | 4    | size of the source SMF
+| 20     | 4    | modification time of the source SMF
+| 24     | 4    | duration in microseconds (time of the last event)
+| 28     | 1    | SMF format
+| 29     | 1    | number of tracks in the SMF
+| 30     | 2    | number of SYSEX/META events cut to fit the record length (65535 max)
+
+This is followed by 12 byte event records:
+
+| Offset | Size | Contents
+|--------|------|----------------------------------------------------------
+| 0      | 4    | absolute tick
+| 4      | 4    | absolute time in microseconds
+| 8      | 1    | track number
+| 9      | 1    | status byte (MIDI status with channel, 0xF0, 0xF7 or 0xFF)
+| 10     | 2    | MIDI data bytes, or the length of the SYSEX/META data
+
+SYSEX and META records are followed by their data, padded to a whole number of records. 
+META data starts with the META type byte, which is included in the length.
+Longer SYSEX or META data is cut to the 65534 bytes that fit the record length, and the 
+number of events cut is kept in the header.
+
+The source SMF size and modification time are used by isCompiledValid() to detect when the 
+compiled file is out of date. loadCompiled() uses this to recompile the file automatically.
+
 \page pageHardware Hardware Interface
 
 The MIDI communications hardware is a opt-isolated byte-based serial interface configured 
@@ -385,6 +577,18 @@ http://www.stephenhobley.com/blog/2011/03/14/the-last-darned-midi-interface-ill-
 #include <Arduino.h>
 #include <FS.h>
 #include <SPIFFS.h>
+#include "MD_MIDISource.h"
+
+#if defined(ESP32)
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#define MIDI_TIMER_ESP32 1    ///< timer driven playback uses esp_timer, pipeline playback a FreeRTOS task
+#elif !defined(ARDUINO)
+#include <pthread.h>
+#define MIDI_TIMER_POSIX 1    ///< timer driven and pipeline playback use a POSIX thread
+#endif
+#include <atomic>
 
 /**
  * \file
@@ -418,11 +622,104 @@ http://www.stephenhobley.com/blog/2011/03/14/the-last-darned-midi-interface-ill-
 #ifndef MIDI_MAX_TRACKS
 /**
  \def MIDI_MAX_TRACKS
- Max number of MIDI tracks. This may be reduced or increased depending on memory requirements.
- 16 tracks is the maximum available to any MIDI device. Fewer tracks may not allow many MIDI
- files to be played, while a minority of SMF may require more tracks.
+ Max number of MIDI tracks accepted by MD_MIDIFile::load(), up to 255. The track data 
+ is allocated by load() for the number of tracks in each file (see 
+ MD_MIDIFile::setTrackArena()), so this does not use any memory.
+ */
+#define MIDI_MAX_TRACKS 255
+#endif
+
+#ifndef MIDI_TRACK_BUFFER_SIZE
+/**
+ \def MIDI_TRACK_BUFFER_SIZE
+ Size in bytes of the read-ahead buffer owned by each track. Track data is read
+ from the file in blocks of this size and events are decoded from the buffer,
+ so the file is only accessed when the buffer runs dry. Larger buffers mean fewer
+ file accesses at the cost of this amount of RAM for each track. Values
+ between 64 and 512 bytes are sensible.
+ */
+#define MIDI_TRACK_BUFFER_SIZE 128
+#endif
+
+#ifndef MIDI_MEMORY_LOAD_SIZE
+/**
+ \def MIDI_MEMORY_LOAD_SIZE
+ Default memory budget in bytes when the whole SMF is loaded into memory (see 
+ MD_MIDIFile::setLoadMode()). Files larger than the budget are streamed from the 
+ file system as normal.
+ */
+#define MIDI_MEMORY_LOAD_SIZE 65536
+#endif
+
+#ifndef MIDI_INDEX_INTERVAL
+/**
+ \def MIDI_INDEX_INTERVAL
+ Default distance between checkpoints in the seek index, in quarter notes (see 
+ MD_MIDIFile::buildIndex()). Each checkpoint uses 16 bytes plus 12 bytes for each 
+ track, so smaller values make seeking faster but use more memory.
+ */
+#define MIDI_INDEX_INTERVAL 16
+#endif
+
+#ifndef MIDI_PIPE_SIZE
+/**
+ \def MIDI_PIPE_SIZE
+ Number of events held in the queue between the decoder and playback in pipeline 
+ mode (see MD_MIDIFile::startPipeline()). Must be a power of 2. Each event uses 
+ sizeof(timed_event) bytes.
+ */
+#define MIDI_PIPE_SIZE 64
+#endif
+
+#ifndef MIDI_PIPE_AHEAD
+/**
+ \def MIDI_PIPE_AHEAD
+ How far ahead of playback, in milliseconds, the decoder reads events in pipeline 
+ mode, if the queue has room. This is the longest file system stall that does not 
+ delay playback.
+ */
+#define MIDI_PIPE_AHEAD 250
+#endif
+
+#ifndef MIDI_PIPE_CORE
+/**
+ \def MIDI_PIPE_CORE
+ ESP32 core that runs the decoder task in pipeline mode. The Arduino loop() runs 
+ on core 1, so the default is core 0.
+ */
+#define MIDI_PIPE_CORE 0
+#endif
+
+#ifndef MIDI_GROUP_SIZE
+/**
+ \def MIDI_GROUP_SIZE
+ Largest number of MD_MIDIFile objects played together by one MD_MIDIGroup.
+ */
+#define MIDI_GROUP_SIZE 4
+#endif
+
+#ifndef MIDI_OUT_BUFFER_SIZE
+/**
+ \def MIDI_OUT_BUFFER_SIZE
+ Size in bytes of the MD_MIDIOut encoding buffer. This is the most written to the 
+ output in one call, a longer batch of events is written in more than one call.
+ */
+#define MIDI_OUT_BUFFER_SIZE 64
+#endif
+
+#ifndef MIDI_FILE_SOURCE
+/**
+ \def MIDI_FILE_SOURCE
+ The byte source class used to read SMF from a file system by MD_MIDIFile::load(). 
+ This is one of the classes defined in MD_MIDISource.h, or any other class that 
+ implements the same methods. The default is the SPIFFS file system for Arduino 
+ builds and POSIX file descriptors otherwise.
  */
-#define MIDI_MAX_TRACKS 16
+#if defined(ARDUINO)
+#define MIDI_FILE_SOURCE MD_MFSourceSPIFFS
+#else
+#define MIDI_FILE_SOURCE MD_MFSourcePosix
+#endif
 #endif
 
 #ifndef TRACK_PRIORITY
@@ -433,6 +730,9 @@ http://www.stephenhobley.com/blog/2011/03/14/the-last-darned-midi-interface-ill-
  one event from each track and cycling through all tracks round robin fashion until 
  no events are left to be processed (EVENT_PRIORITY). This macro definition enables
  the mode of operation implemented in getNextEvent().
+
+ This sets the default for a new MD_MIDIFile object. The mode, or strict time ordering 
+ of events, can also be selected at run time using MD_MIDIFile::setScheduler().
  */
 #define TRACK_PRIORITY  1
 #endif
@@ -446,9 +746,9 @@ http://www.stephenhobley.com/blog/2011/03/14/the-last-darned-midi-interface-ill-
 #define DUMP(s, v)  { Serial.print(F(s)); Serial.print(v); }      ///< Print a value (decimal)
 #define DUMPX(s, x) { Serial.print(F(s)); Serial.print(x,HEX); }  ///< Print a value (hex)
 #else
-#define DUMPS(s)      ///< Print a string
-#define DUMP(s, v)    ///< Print a value (decimal)
-#define DUMPX(s, x)   ///< Print a value (hex)
+#define DUMPS(s)    do {} while (0)   ///< Print a string
+#define DUMP(s, v)  do {} while (0)   ///< Print a value (decimal)
+#define DUMPX(s, x) do {} while (0)   ///< Print a value (hex)
 #endif // DUMP_DATA
 
 // Set Classes for SPIFFS
@@ -456,6 +756,8 @@ typedef FS SDFAT;       ///< SPIFFS class used
 typedef File SDDIR;     ///< File type for folders
 typedef File SDFILE;    ///< File type for files
 
+typedef MIDI_FILE_SOURCE MD_MFSource;  ///< Byte source class used for SMF files
+
 
 /**
  MIDI event definition structure
@@ -500,6 +802,109 @@ typedef struct
   uint8_t data[4];  ///< the data. Only 'size' bytes are valid
 } midi_event;
 
+/**
+ Chase state definition
+
+ Structure holding the controller state of one MIDI channel, collected while
+ seeking in chase mode (see MD_MIDIFile::setChaseMode()). Values that have not 
+ been set by the song are all ones (0xff or 0xffff). This structure is used 
+ internally by the library.
+*/
+typedef struct
+{
+  uint8_t track;      ///< the last track with an event for the channel
+  uint8_t bank[2];    ///< bank select MSB (CC 0) and LSB (CC 32)
+  uint8_t program;    ///< program number
+  uint8_t volume;     ///< channel volume (CC 7)
+  uint8_t pan;        ///< pan (CC 10)
+  uint8_t sustain;    ///< sustain pedal (CC 64)
+  uint16_t bend;      ///< pitch bend, 14 bits
+} chase_state;
+
+/**
+ Compiled event stream record
+
+ Structure holding a record read from a compiled event stream file. This
+ structure is used internally by the library (see \ref pageCompiled).
+*/
+typedef struct
+{
+  uint32_t tick;    ///< absolute time of the event in ticks
+  uint32_t time;    ///< absolute time of the event in microseconds
+  uint8_t track;    ///< the track the event was on
+  uint8_t status;   ///< MIDI status byte with channel, 0xf0/0xf7 for SYSEX or 0xff for META
+  uint16_t param;   ///< MIDI data bytes (data[1] in the low byte) or the SYSEX/META data length
+} mdev_record;
+
+/**
+ Track checkpoint definition
+
+ Structure holding the playback state of a track at a point in the file. This
+ structure is used internally by the library to build the seek index.
+*/
+typedef struct
+{
+  uint32_t offset;    ///< offset into the track of the next byte to read
+  uint32_t dueTick;   ///< absolute tick of the next event, already decoded
+  uint8_t status;     ///< running status (MIDI command with channel)
+  bool eot;           ///< true if the track has ended
+} track_checkpoint;
+
+/**
+ Seek index point definition
+
+ Structure holding the song position and timing state for a checkpoint. This
+ structure is used internally by the library to build the seek index.
+*/
+typedef struct
+{
+  uint32_t tick;      ///< song position in ticks
+  uint32_t time;      ///< song position in microseconds
+  uint32_t usPerQN;   ///< tempo in microseconds per quarter note at this position
+  uint8_t timeSig[2]; ///< time signature at this position
+} index_point;
+
+/**
+ Tempo map entry definition
+
+ Structure holding the song position of a tempo change. This structure is used 
+ internally by the library to build the tempo map.
+*/
+typedef struct
+{
+  uint32_t tick;      ///< song position of the tempo change in ticks
+  uint32_t time;      ///< song position of the tempo change in microseconds
+  uint32_t usPerQN;   ///< tempo in microseconds per quarter note from this position
+} tempo_point;
+
+/**
+ Timing report definition
+
+ Structure returned by MD_MIDIFile::getTimingReport() to compare the playback
+ position with the time elapsed since playback started.
+*/
+typedef struct
+{
+  uint32_t ticks;     ///< ticks played since the start (or last seek)
+  uint32_t elapsed;   ///< microseconds of playback time elapsed, excluding pauses
+  uint32_t songTime;  ///< exact time in microseconds of the ticks played, from the tempo in effect for each tick
+  int32_t drift;      ///< error in microseconds: elapsed time less the song time and the part tick still pending
+} timing_report;
+
+/**
+ Timer playback statistics definition
+
+ Structure returned by MD_MIDIFile::getTimerStats() with the lateness of the
+ dispatches made by the timer driven playback engine.
+*/
+typedef struct
+{
+  uint32_t dispatches;  ///< number of times events were dispatched
+  uint32_t lastLate;    ///< microseconds the last dispatch was after the event was due
+  uint32_t maxLate;     ///< the largest lateness in microseconds
+  uint64_t totalLate;   ///< sum of the lateness of all dispatches in microseconds
+} timer_stats;
+
 /**
  SYSEX event definition structure
 
@@ -514,6 +919,29 @@ typedef struct
   uint8_t data[50]; ///< the data. Only 'size' bytes are valid
 } sysex_event;
 
+/**
+ SYSEX chunk definition structure
+
+ Structure defining part of a SYSEX event. SYSEX events of any size are passed to
+ the callback function registered using setSysexChunkHandler() as a series of 
+ chunks, with a pointer to this structure for each chunk.
+
+ The data points directly into the library's track buffer, so it is only valid during 
+ the callback. The status byte (0xF0) is not included in the data, while the end of 
+ message byte (0xF7) is normally the last byte of the last chunk.
+*/
+typedef struct
+{
+  uint8_t track;        ///< the track this was on
+  uint8_t status;       ///< 0xF0 for a SYSEX message, 0xF7 for an escape or continuation packet
+  bool first;           ///< true for the first chunk of the event
+  bool last;            ///< true for the last chunk of the event
+  uint32_t total;       ///< the number of data bytes in the whole event
+  uint32_t offset;      ///< position of the first byte of this chunk in the event data
+  uint16_t size;        ///< the number of data bytes in this chunk
+  const uint8_t *data;  ///< the data for this chunk. Only 'size' bytes are valid
+} sysex_chunk;
+
 /**
  META event definition structure
 
@@ -533,6 +961,160 @@ typedef struct
   };
 } meta_event;
 
+/**
+ Timed event types
+
+ The type of event held in a timed_event structure.
+*/
+enum timed_type_t
+{
+  TIMED_MIDI,   ///< a MIDI event, data in timed_event::midi
+  TIMED_SYSEX,  ///< a SYSEX event, data in timed_event::sysex
+};
+
+/**
+ Timed event definition
+
+ Structure holding an event returned by MD_MIDIFile::getEventWindow(), with the
+ time it is due.
+*/
+typedef struct
+{
+  uint32_t time;        ///< micros() time the event is due
+  uint32_t tick;        ///< absolute tick of the event in the file
+  timed_type_t type;    ///< which of the event structures is valid
+  union
+  {
+    midi_event midi;    ///< the MIDI event for TIMED_MIDI
+    sysex_event sysex;  ///< the SYSEX event for TIMED_SYSEX
+  };
+} timed_event;
+
+
+/**
+ * MIDI output byte encoder
+ *
+ * Turns the midi_event and SYSEX data from the library into the bytes sent on a 
+ * MIDI port (eg, Serial at 31250 baud), removing repeated status bytes (outgoing 
+ * running status). The bytes are kept in a buffer and written to the port in one
+ * write() call by flush(), so all the events processed at the same tick go out 
+ * together.
+ *
+ * Pass the object to MD_MIDIFile::setMidiOutput() to have the library encode every 
+ * MIDI and SYSEX event and flush the buffer after each call to getNextEvent(). The 
+ * methods can also be called directly from the sketch callbacks.
+ *
+ * \sa \ref pageLibrary
+ */
+class MD_MIDIOut
+{
+public:
+  /** 
+   * Class Constructor
+   *
+   * Instantiate a new encoder writing to a port, with running status enabled.
+   *
+   * \param out the port the bytes are written to, any Print derived object (eg, Serial).
+   */
+  MD_MIDIOut(Print &out);
+
+  /** 
+   * Enable or disable outgoing running status
+   *
+   * With running status the status byte of a MIDI message is only sent when it is 
+   * different from the last one sent, saving one byte in three for dense note passages.
+   * Some older receivers do not handle running status and it can be disabled. 
+   * Default is enabled.
+   *
+   * \param bMode true to use running status.
+   * \return No return data.
+   */
+  inline void setRunningStatus(bool bMode) { _runningStatus = bMode; _status = 0; }
+
+  /** 
+   * Send note off messages as note on with zero velocity
+   *
+   * Note off (0x8n) messages are sent as note on (0x9n) with velocity 0, which means 
+   * the same to the receiver, so that note on and note off messages share the running 
+   * status. The note off velocity is lost. Default is disabled.
+   *
+   * \param bMode true to send note off as note on.
+   * \return No return data.
+   */
+  inline void setNoteOffAsNoteOn(bool bMode) { _noteOffAsOn = bMode; }
+
+  /** 
+   * Encode a MIDI event
+   *
+   * \param pev pointer to the MIDI event, as passed to the MIDI callback.
+   * \return No return data.
+   */
+  void midi(const midi_event *pev);
+
+  /** 
+   * Encode a SYSEX event
+   *
+   * Only the bytes held in the sysex_event are sent. A truncated event is ended with 
+   * 0xF7 so the receiver is not left waiting for the end of the message; use 
+   * sysexChunk() for SYSEX events of any size.
+   *
+   * \param pev pointer to the SYSEX event, as passed to the SYSEX callback.
+   * \return No return data.
+   */
+  void sysex(const sysex_event *pev);
+
+  /** 
+   * Encode part of a SYSEX event
+   *
+   * \param pch pointer to the SYSEX chunk, as passed to the SYSEX chunk callback.
+   * \return No return data.
+   */
+  void sysexChunk(const sysex_chunk *pch);
+
+  /** 
+   * Write the encoded bytes to the port
+   *
+   * \return No return data.
+   */
+  void flush(void);
+
+  /** 
+   * Forget the running status
+   *
+   * The next MIDI message is sent with its status byte. Call this if anything else 
+   * writes to the same port or the receiver is reconnected.
+   *
+   * \return No return data.
+   */
+  inline void reset(void) { _status = 0; }
+
+  /** 
+   * Get the number of bytes written to the port
+   *
+   * \return the number of bytes written since the object was created.
+   */
+  inline uint32_t getBytesWritten(void) { return(_written); }
+
+  /** 
+   * Get the number of status bytes removed by running status
+   *
+   * \return the number of bytes saved since the object was created.
+   */
+  inline uint32_t getBytesSaved(void) { return(_saved); }
+
+private:
+  void    put(const uint8_t *data, uint16_t size); ///< add bytes to the buffer, flushing as needed
+
+  Print     &_out;          ///< the port the bytes are written to
+  uint8_t   _buf[MIDI_OUT_BUFFER_SIZE]; ///< bytes not yet written
+  uint16_t  _len;           ///< number of bytes in the buffer
+  uint8_t   _status;        ///< last status byte sent, 0 if none
+  bool      _runningStatus; ///< true if repeated status bytes are left out
+  bool      _noteOffAsOn;   ///< true if note off is sent as note on velocity 0
+  uint32_t  _written;       ///< bytes written to the port
+  uint32_t  _saved;         ///< status bytes left out
+};
+
 
 class MD_MIDIFile;
 
@@ -605,15 +1187,26 @@ public:
    *
    * Each track is made up of a sequence of MIDI and SYSEX events that are processed 
    * in sequential order using this method. An event will not be processed if the track
-   * is at end of track or insufficient time has elapsed for the next event to be 
-   * triggered. Once processed the track position is advanced to the next event to be 
+   * is at end of track or the MIDI file tick count has not yet reached the tick the
+   * event is due. Once processed the track position is advanced to the next event to be 
    * processed.
    * 
    * \param mf          pointer to the MIDI file object calling this track.
-   * \param tickCount   the number of ticks since this method was last called for this track.
    * \return true if an event was found and processed.
    */
-  bool getNextEvent(MD_MIDIFile *mf, uint16_t tickCount);
+  bool getNextEvent(MD_MIDIFile *mf);
+
+  /** 
+   * Get the tick the next event is due
+   *
+   * The delta time of the next event is decoded only once and the absolute tick it
+   * is due (counted from the start of playback) is remembered until the event is 
+   * processed, so repeated calls do not access the track data.
+   * 
+   * \param mf          pointer to the MIDI file object calling this track.
+   * \return the absolute tick for the next event. Not meaningful at end of track.
+   */
+  uint32_t getDueTick(MD_MIDIFile *mf);
   
   /** 
    * Load the definition of a track
@@ -621,15 +1214,57 @@ public:
    * Before it can be processed, each track must be initialise to its start conditions by 
    * invoking this method.
    * 
-   * \param trackId the identifying number for the track [0..MIDI_MAX_TRACKS-1].
-   * \param mf      pointer to the MIDI file object calling this track.
+   * The source must be positioned at the start of the track chunk and is left 
+   * at the start of the next chunk.
+   *
+   * \param trackId the identifying number for the track [0..getTrackCount()-1].
+   * \param src     pointer to the byte source with the SMF data.
    * \return Error code with one of these values 
    * - -1 if successful 
    * - 0 if the track header is not in the correct format 
    * - 1 if the track chunk is past the end of file
    */
-  int load(uint8_t trackId, MD_MIDIFile *mf);
+  template <class S> int load(uint8_t trackId, S *src);
   
+  /** 
+   * Play the track from a memory image of the file
+   *
+   * Once the track has been loaded, this method points the track data at the same data 
+   * in a memory copy of the whole file. All further decoding runs from memory and the 
+   * file is no longer accessed for this track.
+   * 
+   * \param image pointer to the copy of the whole file in memory.
+   * \param size  the size of the file image in bytes.
+   * \return No return data.
+   */
+  void setMemory(const uint8_t *image, uint32_t size);
+
+  /** 
+   * Set where the track publishes its scheduling state
+   *
+   * The track keeps the value at slot up to date with the tick its next event is 
+   * due, so that MD_MIDIFile can check which tracks have work to do by scanning a 
+   * compact array instead of the track objects. The value is UINT32_MAX when the 
+   * track has ended and 0 when the next DeltaT has not been decoded yet.
+   * 
+   * \param slot pointer to the value for this track.
+   * \return No return data.
+   */
+  void setDueSlot(uint32_t *slot) { _dueSlot = slot; publishDue(); }
+
+  /** 
+   * Top up the read-ahead buffer before it runs dry
+   *
+   * If fewer than low bytes are left to decode in the buffer, they are moved to the 
+   * start and the rest of the buffer is filled from the file with one seek and read. 
+   * Tracks played from memory are never read.
+   *
+   * \param mf   pointer to the MIDIFile object with the file.
+   * \param low  the number of bytes left below which the buffer is topped up.
+   * \return true if the file was read.
+   */
+  bool prefetch(MD_MIDIFile *mf, uint16_t low);
+
   /** 
    * Reset the track to the start of the data in the file
    *
@@ -647,6 +1282,26 @@ public:
    * \return No return data.
    */
   void syncTime(void);
+
+  /** 
+   * Save the playback state of the track
+   *
+   * The due tick of the next event is decoded if needed so the checkpoint can
+   * be restored without reading the track.
+   *
+   * \param mf  pointer to the MIDIFile object with the file.
+   * \param cp  pointer to the checkpoint to fill in.
+   * \return No return data.
+   */
+  void getCheckpoint(MD_MIDIFile *mf, track_checkpoint *cp);
+
+  /** 
+   * Restore the playback state of the track
+   *
+   * \param cp  pointer to a checkpoint saved by getCheckpoint().
+   * \return No return data.
+   */
+  void setCheckpoint(const track_checkpoint *cp);
   /** @} */
 
   //--------------------------------------------------------------
@@ -672,62 +1327,204 @@ protected:
    *
    * Read and process the next event for this track from the file.
    *
-   * \param mf  pointer tho the MIDIFile object with the file to process.
+   * \param mf  pointer to the MIDIFile object with the file to process.
    *
    * \return No return data.
    */
   void  parseEvent(MD_MIDIFile *mf);
 
   /**
-   * Initialize the class all in one place
+   * Process a SYSEX event
+   *
+   * \param mf     pointer to the MIDIFile object with the file to process.
+   * \param eType  the status byte already read, 0xF0 or 0xF7.
    *
    * \return No return data.
    */
-  void  reset(void);
-
-  uint8_t   _trackId;       ///< the id for this track
-  uint32_t  _length;        ///< length of track in bytes
-  uint32_t  _startOffset;   ///< start of the track in bytes from start of file
-  uint32_t  _currOffset;    ///< offset from start of the track for the next read of SD data
-  bool      _endOfTrack;    ///< true when we have reached end of track or we have encountered an undefined event
-  uint32_t  _elapsedTicks;  ///< the total number of elapsed ticks since last event
-  midi_event  _mev;         ///< data for MIDI callback function - persists between calls for run-on messages
-};
-
-/**
- * Core object for the MD_MIDIFile library
- *
- * This is the class to handle a MIDI file, including all tracks, and is the only one 
- * available to user programs.
- */
-class MD_MIDIFile 
-{
-public:
-  friend class MD_MFTrack;
+  void  parseSysex(MD_MIDIFile *mf, uint8_t eType);
 
-  /** Error codes as constants
+  /**
+   * Process a META event
+   *
+   * \param mf  pointer to the MIDIFile object with the file to process.
+   *
+   * \return No return data.
    */
-  static const int E_OK = 0;       ///< No errors
-  static const int E_NO_FILE = 1;  ///< Blank file name
-  static const int E_NO_OPEN = 2;  ///< Can't open file specified
-  static const int E_NOT_MIDI = 3; ///< File is not MIDI format
-  static const int E_HEADER = 4;   ///< MIDI header size incorrect
-  static const int E_FORMAT = 5;   ///< File format type not 0 or 1
-  static const int E_FORMAT0 = 6;  ///< File format 0 but more than 1 track
-  static const int E_TRACKS = 7;   ///< More than MIDI_MAX_TRACKS required
+  void  parseMeta(MD_MIDIFile *mf);
 
-  // Errors >= 10
-  static const int E_CHUNK_ID = 0;   ///< error >= 10; n0 Track n track chunk not found
-  static const int E_CHUNK_EOF = 1;  ///< error >= 10; n1 Track n chunk size past end of file
+  /**
+   * Initialize the class all in one place
+   *
+   * \return No return data.
+   */
+  void  reset(void);
 
   /**
-   * Class Constructor
+   * Publish the scheduling state of the track
    *
-   * Instantiate a new instance of the class.
+   * Called whenever the due tick or the end of track change.
    *
    * \return No return data.
    */
-  MD_MIDIFile(void);
+  void publishDue(void) { *_dueSlot = _endOfTrack ? UINT32_MAX : (_dueValid ? _dueTick : 0); }
+
+  /**
+   * Read the next byte of track data
+   *
+   * Returns the byte at the current offset from the read-ahead buffer, refilling 
+   * the buffer from the file if it has run dry.
+   *
+   * \param mf  pointer to the MIDIFile object with the file to process.
+   *
+   * \return the byte read, 0 if there is no more track data.
+   */
+  uint8_t getByte(MD_MIDIFile *mf);
+
+  /**
+   * Read a variable length parameter from the track data
+   *
+   * \sa readVarLen()
+   *
+   * \param mf  pointer to the MIDIFile object with the file to process.
+   *
+   * \return the value read.
+   */
+  uint32_t getVarLen(MD_MIDIFile *mf);
+
+  /**
+   * Read a multi byte value from the track data
+   *
+   * \sa readMultiByte()
+   *
+   * \param mf    pointer to the MIDIFile object with the file to process.
+   * \param nLen  one of MB_LONG, MB_TRYTE, MB_WORD, MB_BYTE to specify the number of bytes to read.
+   *
+   * \return the value read.
+   */
+  uint32_t getMultiByte(MD_MIDIFile *mf, uint8_t nLen);
+
+  /**
+   * Get a block of track data without copying it
+   *
+   * Points to the track data at the current offset in the read-ahead buffer (or the 
+   * file image in memory), refilling the buffer if it has run dry. The block ends at 
+   * the end of the buffer, so it may be shorter than requested.
+   *
+   * \param mf   pointer to the MIDIFile object with the file to process.
+   * \param p    set to point to the data.
+   * \param len  the number of bytes wanted.
+   *
+   * \return the number of bytes available at p, 0 if there is no more track data.
+   */
+  uint16_t getBlock(MD_MIDIFile *mf, const uint8_t **p, uint32_t len);
+
+  /**
+   * Skip over track data
+   *
+   * \param n the number of bytes to skip.
+   *
+   * \return No return data.
+   */
+  void skipBytes(uint32_t n) { _currOffset += n; }
+
+  /**
+   * Refill the read-ahead buffer
+   *
+   * Reads the next block of track data, starting at the current offset, from the
+   * file into the read-ahead buffer with a single seek and bulk read.
+   *
+   * \param mf  pointer to the MIDIFile object with the file to process.
+   *
+   * \return true if any data was read.
+   */
+  bool fillBuffer(MD_MIDIFile *mf);
+
+  uint8_t   _trackId;       ///< the id for this track
+  uint32_t  _length;        ///< length of track in bytes
+  uint32_t  _startOffset;   ///< start of the track in bytes from start of file
+  uint32_t  _currOffset;    ///< offset from start of the track for the next read of SD data
+  const uint8_t *_buf;      ///< current track data window, either _bufData or the file image in memory
+  uint32_t  _bufOffset;     ///< offset from start of the track of the first byte in _buf
+  uint32_t  _bufLen;        ///< number of valid bytes in _buf
+  uint8_t   _bufData[MIDI_TRACK_BUFFER_SIZE]; ///< read-ahead buffer for track data
+  bool      _endOfTrack;    ///< true when we have reached end of track or we have encountered an undefined event
+  uint32_t  _eventTick;     ///< the tick the last processed event was due
+  uint32_t  _dueTick;       ///< the tick the next event is due, valid if _dueValid is true
+  bool      _dueValid;      ///< true when the DeltaT for the next event has been decoded into _dueTick
+  uint32_t  *_dueSlot;      ///< where the scheduling state is published, see setDueSlot()
+  midi_event  _mev;         ///< data for MIDI callback function - persists between calls for run-on messages
+};
+
+/**
+ * Core object for the MD_MIDIFile library
+ *
+ * This is the class to handle a MIDI file, including all tracks, and is the only one 
+ * available to user programs.
+ */
+class MD_MIDIFile 
+{
+public:
+  friend class MD_MFTrack;
+
+  /** Error codes as constants
+   */
+  static const int E_OK = 0;       ///< No errors
+  static const int E_NO_FILE = 1;  ///< Blank file name
+  static const int E_NO_OPEN = 2;  ///< Can't open file specified
+  static const int E_NOT_MIDI = 3; ///< File is not MIDI format
+  static const int E_HEADER = 4;   ///< MIDI header size incorrect
+  static const int E_FORMAT = 5;   ///< File format type not 0 or 1
+  static const int E_FORMAT0 = 6;  ///< File format 0 but more than 1 track
+  static const int E_TRACKS = 7;   ///< More than MIDI_MAX_TRACKS required or the track arena is too small
+  static const int E_NO_MEMORY = 8;///< Not enough memory for the tracks or to compile the file
+  static const int E_WRITE = 9;    ///< Can't write the compiled file
+
+  // Errors >= 10
+  static const int E_CHUNK_ID = 0;   ///< error >= 10; n0 Track n track chunk not found
+  static const int E_CHUNK_EOF = 1;  ///< error >= 10; n1 Track n chunk size past end of file
+
+  /**
+   * Where the SMF data is played from, set using setLoadMode().
+   */
+  enum loadMode_t
+  {
+    LOAD_STREAM,  ///< stream track data from the file system (default)
+    LOAD_RAM,     ///< load the whole file into internal RAM
+    LOAD_PSRAM,   ///< load the whole file into external PSRAM (ESP32 only)
+    LOAD_BUFFER,  ///< load the whole file into the buffer supplied with setLoadBuffer()
+  };
+
+  /**
+   * How processEvents() orders the events due, set using setScheduler().
+   */
+  enum scheduler_t
+  {
+    SCHED_TRACK,  ///< all the events on one track before the next track (TRACK_PRIORITY)
+    SCHED_EVENT,  ///< one event from each track in turn (EVENT_PRIORITY)
+    SCHED_TIME,   ///< strict time order, earliest event first and track order for the same tick
+  };
+
+  /**
+   * Transport commands posted from another task with postTransport().
+   */
+  enum transport_t
+  {
+    TRANSPORT_PAUSE,        ///< pause(value != 0)
+    TRANSPORT_RESTART,      ///< restart(), value is not used
+    TRANSPORT_LOOP,         ///< looping(value != 0)
+    TRANSPORT_TEMPO_ADJUST, ///< setTempoAdjust(value)
+    TRANSPORT_SEEK_TICK,    ///< seekToTick(value)
+    TRANSPORT_SEEK_MICROS,  ///< seekToMicros(value)
+  };
+
+  /**
+   * Class Constructor
+   *
+   * Instantiate a new instance of the class.
+   *
+   * \return No return data.
+   */
+  MD_MIDIFile(void);
   
   /** 
    * Class Destructor
@@ -763,12 +1560,38 @@ public:
    * Get the internally calculated tick time
    *
    * Changes to tempo, TPQN and time signature all affect the tick time. This returns the
-   * number of microseconds for each tick.
+   * number of microseconds for each tick. Internally the tick time is kept with a
+   * fraction of a microsecond so that playback does not drift from real time.
    * 
-   * \return the tick time in microseconds
+   * \return the tick time in whole microseconds
    */
   inline uint32_t getTickTime(void) { return (_tickTime); }
 
+  /** 
+   * Get the tempo in microseconds per quarter note
+   *
+   * This is the exact value set by the SMF tempo META event or setMicrosecondPerQuarterNote(),
+   * and does not include the tempo adjustment.
+   * 
+   * \return the number of microseconds per quarter note.
+   */
+  inline uint32_t getMicrosecondPerQuarterNote(void) { return(_usPerQN); }
+
+  /** 
+   * Get the playback timing report
+   *
+   * Reports the time elapsed since playback started from getNextEvent() against the
+   * exact time of the ticks played, to check that playback is not drifting from real 
+   * time. The report restarts whenever the tracks are synchronized (eg, after restart()) 
+   * or a seek. Time while paused is not included.
+   *
+   * Ticks processed by calling processEvents() directly are not included.
+   * 
+   * \param r pointer to the structure to fill in.
+   * \return No return data.
+   */
+  void getTimingReport(timing_report *r);
+
   /** 
    * Get the overall tempo
    *
@@ -968,13 +1791,368 @@ public:
    * The file name buffer is located in user code and must persist during 
    * this call. 
    *
-   * \sa setFileFolder()
+   * Depending on the setLoadMode() setting, the whole file may be read into
+   * memory for playback.
+   *
+   * \sa setFileFolder(), setLoadMode()
    *
    * \param fname pointer to a user buffered string with the file name.
    * \return Error code with one of the E_* error values
    */
   int load(const char *fname);
 
+  /** 
+   * Load an SMF image from memory
+   *
+   * The SMF is played directly from a complete copy of the file already in 
+   * memory, such as a buffer in RAM or a constant array in flash. The image is read
+   * directly, so the flash must be memory mapped as it is on the ESP32.
+   * The file system is not used and all the tracks are decoded from the image.
+   *
+   * The image is located in user code and must persist until the file is closed.
+   *
+   * \param image pointer to the SMF image.
+   * \param size  the size of the image in bytes.
+   * \return Error code with one of the E_* error values
+   */
+  int load(const uint8_t *image, uint32_t size);
+
+  /** 
+   * Set how the SMF is loaded
+   *
+   * By default the track data is streamed from the file system during playback. 
+   * Alternatively the whole file can be read into a single memory buffer by load(), 
+   * after which all tracks are decoded from memory and the file system is not 
+   * accessed during playback. This removes any timing jitter caused by file system 
+   * delays at the cost of memory.
+   *
+   * The memory is allocated from internal RAM (LOAD_RAM) or from PSRAM (LOAD_PSRAM) 
+   * when the file is loaded and released when the file is closed. For LOAD_BUFFER, 
+   * use setLoadBuffer() to specify the buffer.
+   *
+   * If the file is larger than the memory budget, or the memory cannot be allocated,
+   * the file is streamed from the file system as normal. isInMemory() reports which
+   * was used for the current file.
+   *
+   * The setting takes effect at the next load().
+   *
+   * \sa setLoadBuffer(), isInMemory()
+   *
+   * \param mode   one of the loadMode_t values.
+   * \param budget the largest file size (bytes) that will be loaded into memory.
+   * \return No return data.
+   */
+  void setLoadMode(loadMode_t mode, uint32_t budget = MIDI_MEMORY_LOAD_SIZE);
+
+  /** 
+   * Load the SMF into a user supplied buffer
+   *
+   * Sets the load mode to LOAD_BUFFER. Files that fit into the buffer are read into 
+   * it by load() and played from memory. Larger files are streamed from the file 
+   * system. The buffer is located in user code and must persist until the file is 
+   * closed.
+   *
+   * \sa setLoadMode()
+   *
+   * \param buf  pointer to the buffer.
+   * \param size the size of the buffer in bytes.
+   * \return No return data.
+   */
+  void setLoadBuffer(uint8_t *buf, uint32_t size);
+
+  /** 
+   * Check if the SMF is being played from memory
+   *
+   * \sa setLoadMode()
+   *
+   * \return true if the current file was loaded into memory, false if it is streamed.
+   */
+  inline bool isInMemory(void) { return(_image != nullptr); }
+
+  /** 
+   * Set the memory used for the track data
+   *
+   * The data for each track (the MD_MFTrack class, including its read-ahead buffer)
+   * is allocated by load() for the number of tracks in the file. By default this 
+   * memory is allocated from the heap and released when the file is closed.
+   * Alternatively the tracks can be placed in an arena supplied by the application,
+   * sized using getTrackArenaSize() for the largest file to be played. load() fails
+   * with E_TRACKS if the file has more tracks than fit into the arena.
+   *
+   * The arena is located in user code and must persist while files are loaded. 
+   * The setting takes effect at the next load(). Set arena to nullptr to go back 
+   * to using the heap.
+   *
+   * \sa getTrackArenaSize()
+   *
+   * \param arena pointer to the memory for the tracks.
+   * \param size  the size of the arena in bytes.
+   * \return No return data.
+   */
+  void setTrackArena(void *arena, uint32_t size);
+
+  /** 
+   * Get the arena size needed for a number of tracks
+   *
+   * \sa setTrackArena()
+   *
+   * \param tracks the number of tracks.
+   * \return the size of the arena in bytes, including any space needed for alignment.
+   */
+  static constexpr uint32_t getTrackArenaSize(uint8_t tracks) { return((tracks * (sizeof(MD_MFTrack) + sizeof(uint32_t) + sizeof(sched_entry))) + alignof(MD_MFTrack) - 1); }
+
+  /** @} */
+
+  //--------------------------------------------------------------
+  /** \name Methods for compiled event stream files
+   * @{
+   */
+  /** 
+   * Compile an SMF into an event stream file
+   *
+   * The SMF is converted into a compiled event stream file (\ref pageCompiled) that
+   * can be played by load() with much less processing than the original SMF. The
+   * whole SMF is read into memory during the conversion.
+   *
+   * This method does not affect the SMF currently loaded, if any.
+   *
+   * \sa loadCompiled()
+   *
+   * \param smfName pointer to a string with the name of the SMF to compile.
+   * \param devName pointer to a string with the name of the compiled file to create.
+   * \return Error code with one of the E_* error values
+   */
+  static int compile(const char *smfName, const char *devName);
+
+  /** 
+   * Check a compiled event stream file is up to date
+   *
+   * The compiled file records the size and modification time of the SMF it was
+   * created from. If either has changed the compiled file is out of date.
+   *
+   * \param smfName pointer to a string with the name of the SMF.
+   * \param devName pointer to a string with the name of the compiled file.
+   * \return true if the compiled file exists and matches the SMF.
+   */
+  static bool isCompiledValid(const char *smfName, const char *devName);
+
+  /** 
+   * Load the compiled version of an SMF
+   *
+   * Loads the compiled event stream file for the SMF, first creating it using
+   * compile() if it does not exist or is out of date. If the file cannot be 
+   * compiled the SMF is loaded as normal.
+   *
+   * \sa compile(), load()
+   *
+   * \param smfName pointer to a string with the name of the SMF.
+   * \param devName pointer to a string with the name of the compiled file.
+   * \return Error code with one of the E_* error values
+   */
+  int loadCompiled(const char *smfName, const char *devName);
+
+  /** 
+   * Check if a compiled event stream is being played
+   *
+   * \return true if the file loaded is a compiled event stream file.
+   */
+  inline bool isCompiled(void) { return(_devMode); }
+
+  /** @} */
+
+  //--------------------------------------------------------------
+  /** \name Methods for seeking to a song position
+   * @{
+   */
+  /** 
+   * Build the seek index for the current file
+   *
+   * The seek index holds the state of all the tracks at regular checkpoints
+   * through the file, so that seekToTick() and seekToMicros() can jump close to 
+   * the required position instead of replaying the song from the start. The index 
+   * is built by reading the file once with all callbacks disabled, so this should 
+   * be done just after load(). The file is rewound to the start afterwards.
+   *
+   * If idxName is specified the index is read from this file when it is up to
+   * date with the SMF (same size and modification time), otherwise the index is
+   * built and then saved to this file for next time.
+   *
+   * The index memory is allocated from the heap and released by close().
+   *
+   * \sa seekToTick(), seekToMicros(), MIDI_INDEX_INTERVAL
+   *
+   * \param interval the distance between checkpoints in ticks. 0 uses MIDI_INDEX_INTERVAL quarter notes.
+   * \param idxName  optional pointer to a string with the name of the index file.
+   * \return Error code with one of the E_* error values
+   */
+  int buildIndex(uint32_t interval = 0, const char *idxName = nullptr);
+
+  /** 
+   * Check if the seek index is available
+   *
+   * \return true if the index has been built or loaded.
+   */
+  inline bool isIndexed(void) { return(_idxCount != 0); }
+
+  /** 
+   * Move the playback position to the specified tick
+   *
+   * All the tracks are set to continue playing from the first event at or after 
+   * the specified tick. The tempo and time signature are set to the values at 
+   * that position. The events skipped are not sent to the callbacks, and the notes 
+   * sounding are turned off automatically before seeking (see flushActiveNotes()).
+   * Only notes from events read with getEventWindow() are not tracked and need to be 
+   * turned off by user code.
+   *
+   * Without a seek index the song is replayed silently from the start. This method 
+   * is not available when playing compiled event stream files.
+   *
+   * \sa buildIndex(), seekToMicros()
+   *
+   * \param tick the song position in ticks from the start of the file.
+   * \return false if the position cannot be set.
+   */
+  bool seekToTick(uint32_t tick);
+
+  /** 
+   * Move the playback position to the specified time
+   *
+   * As for seekToTick(), with the position specified in microseconds from the start 
+   * of the file, following all the tempo changes in the file. The current tempo 
+   * adjustment is ignored.
+   *
+   * \sa buildIndex(), seekToTick()
+   *
+   * \param us the song position in microseconds from the start of the file.
+   * \return false if the position cannot be set.
+   */
+  bool seekToMicros(uint32_t us);
+
+  /** 
+   * Set the chase mode for seeking
+   *
+   * In chase mode seekToTick() and seekToMicros() keep track of the controller 
+   * state of each MIDI channel in the events they skip: bank select, program, 
+   * volume, pan, sustain and pitch bend. When the new position is reached only 
+   * the values set by the song are sent to the MIDI callback, once for each 
+   * channel, before normal playback continues. The playback device is then in 
+   * the same state as if the song had been played from the start.
+   *
+   * The controller state is not held in the seek index, so chasing always 
+   * replays the song silently from the start.
+   *
+   * \sa seekToTick(), seekToMicros()
+   *
+   * \param bMode Set true to enable mode, false to disable.
+   * \return No return data.
+   */
+  inline void setChaseMode(bool bMode) { _chaseMode = bMode; }
+
+  /** 
+   * Get the chase mode for seeking
+   *
+   * \sa setChaseMode()
+   *
+   * \return true if chase mode is enabled.
+   */
+  inline bool getChaseMode(void) { return(_chaseMode); }
+
+  /** @} */
+
+  //--------------------------------------------------------------
+  /** \name Methods for the song tempo map
+   * @{
+   */
+  /** 
+   * Set whether load() builds the tempo map
+   *
+   * When enabled, load() calls buildTempoMap() after the file is loaded so that
+   * the song duration and position conversions are available straight away. This
+   * reads the whole file once, which delays the end of load() for large files
+   * that are streamed from the file system.
+   *
+   * The setting takes effect at the next load(). The default is disabled.
+   *
+   * \sa buildTempoMap()
+   *
+   * \param bMode Set true to enable mode, false to disable.
+   * \return No return data.
+   */
+  inline void setTempoMap(bool bMode) { _tmapAuto = bMode; }
+
+  /** 
+   * Build the tempo map for the current file
+   *
+   * The tempo map holds the song position of every tempo change in the file and
+   * the position of the last event. The song duration and the conversions between 
+   * ticks and time are then calculated without replaying the file, using a binary
+   * search of the map. The map is built by reading the file once with all callbacks 
+   * disabled and the file is rewound to the start afterwards.
+   *
+   * The map memory (12 bytes for each tempo change) is allocated from the heap and 
+   * released by close(). This method is not available when playing compiled event 
+   * stream files.
+   *
+   * \sa setTempoMap(), getDurationMicros(), tickToMicros(), microsToTick()
+   *
+   * \return Error code with one of the E_* error values
+   */
+  int buildTempoMap(void);
+
+  /** 
+   * Check if the tempo map is available
+   *
+   * \return true if the tempo map has been built for the current file.
+   */
+  inline bool isTempoMapped(void) { return(_tmapCount != 0); }
+
+  /** 
+   * Get the duration of the song in ticks
+   *
+   * \sa buildTempoMap()
+   *
+   * \return the tick of the last event in the file, 0 if there is no tempo map.
+   */
+  inline uint32_t getDurationTicks(void) { return(_tmapEndTick); }
+
+  /** 
+   * Get the duration of the song in microseconds
+   *
+   * The duration follows all the tempo changes in the file. The current tempo 
+   * adjustment is ignored.
+   *
+   * \sa buildTempoMap()
+   *
+   * \return the time of the last event in the file, 0 if there is no tempo map.
+   */
+  uint32_t getDurationMicros(void);
+
+  /** 
+   * Convert a song position in ticks to microseconds
+   *
+   * The time follows all the tempo changes in the file before the tick. The current 
+   * tempo adjustment is ignored. Without a tempo map the current tempo is used for 
+   * the whole song.
+   *
+   * \sa buildTempoMap(), microsToTick()
+   *
+   * \param tick the song position in ticks from the start of the file.
+   * \return the song position in microseconds from the start of the file, rounded up.
+   */
+  uint32_t tickToMicros(uint32_t tick);
+
+  /** 
+   * Convert a song position in microseconds to ticks
+   *
+   * The inverse of tickToMicros(), rounded down to a whole tick.
+   *
+   * \sa buildTempoMap(), tickToMicros()
+   *
+   * \param us the song position in microseconds from the start of the file.
+   * \return the song position in ticks from the start of the file.
+   */
+  uint32_t microsToTick(uint32_t us);
+
   /** @} */
 
   //--------------------------------------------------------------
@@ -1000,7 +2178,7 @@ public:
    * Get the number of tracks in the file
    *
    * The SMF header specifies the number of MIDI tracks in the file. This must be
-   * between [0..MIDI_MAX_TRACKS-1] for the SMF to be successfully processed.
+   * between [0..MIDI_MAX_TRACKS] for the SMF to be successfully processed.
    * 
    * The load() method must be invoked to read the SMF header information.
    * 
@@ -1044,9 +2222,10 @@ public:
    * SMF playback can be paused (true) or un-paused (false) using this method. Whilst in pause 
    * mode, all callbacks are suspended. 
    * 
-   * Note that this call only stops the library from processing the file and has no effect 
-   * on the playback device. Silencing the MIDI playback device during the pause is the 
-   * responsibility of the user application.
+   * Pausing turns off the notes sounding automatically (see flushActiveNotes()), as do 
+   * restart(), the seek methods and close(). Only notes from events read with 
+   * getEventWindow() are not tracked, so silencing the playback device for those is 
+   * the responsibility of the user application.
    * 
    * \param bMode Set true to enable mode, false to disable.
    *
@@ -1074,6 +2253,87 @@ public:
    * \return No return data.
    */
   void restart(void);
+
+  /**
+   * Turn off the notes that are sounding
+   *
+   * The library keeps a table of the notes that are on for each channel, from the note 
+   * on and note off events passed to the MIDI callback or output. This method sends a 
+   * note off (with the track set to 0) through the MIDI callback and output for each 
+   * note in the table, and clears it. This is done automatically by pause(true), restart(), seekToTick(), 
+   * seekToMicros() and close(), so notes do not hang when playback stops or jumps, 
+   * without the traffic of an All Notes Off or All Sound Off on every channel.
+   *
+   * Events read with getEventWindow() are not in the table, as they are not passed to
+   * the callback.
+   *
+   * \sa isNoteActive()
+   *
+   * \return the number of note off events sent.
+   */
+  uint16_t flushActiveNotes(void);
+
+  /**
+   * Check if a note is sounding
+   *
+   * \sa flushActiveNotes()
+   *
+   * \param channel the MIDI channel [0..15].
+   * \param note    the note number [0..127].
+   * \return true if a note on has been sent for the note and not yet turned off.
+   */
+  inline bool isNoteActive(uint8_t channel, uint8_t note) { return((_activeNote[channel & 0xf][(note & 0x7f) >> 5] >> (note & 31)) & 1); }
+
+  /**
+   * Post a transport command from another task
+   *
+   * The playback control methods (pause(), restart(), looping(), setTempoAdjust() and 
+   * the seek methods) change the playback state directly and must be called from the 
+   * task that plays the file. This method can be called from any task (or more than 
+   * one) at any time. The command is recorded without locking and applied by the 
+   * playback task at the start of the next getNextEvent(), which includes timer driven 
+   * and pipeline playback. getMicrosToNextEvent() returns 0 while a command is waiting,
+   * so a playback task sleeping until the next event (or paused) wakes up for it.
+   *
+   * Only the last value posted for each command is kept. Commands waiting at the same 
+   * time are applied in the order restart, seek, loop, tempo and then pause, so for 
+   * example a seek and a pause posted together leave playback paused at the new position.
+   * In pipeline mode the loop and tempo commands are applied by the decoder task, and 
+   * take effect after the events already in the queue.
+   *
+   * \sa isTransportPending()
+   *
+   * \param cmd   the command, one of the transport_t values.
+   * \param value the parameter for the command.
+   * \return No return data.
+   */
+  void postTransport(transport_t cmd, int32_t value = 0);
+
+  /**
+   * Check if transport commands are waiting
+   *
+   * \sa postTransport()
+   *
+   * \return true if a command posted has not yet been applied.
+   */
+  inline bool isTransportPending(void) { return(_ctlPending.load(std::memory_order_relaxed) != 0); }
+
+  /**
+   * Read track data ahead of time
+   *
+   * Each track reads its data from the file in blocks of MIDI_TRACK_BUFFER_SIZE bytes 
+   * when its buffer runs dry, in the middle of processing events. This method tops up 
+   * the buffer of each track with fewer than low bytes left, in file order, so the reads
+   * can be done together at a time chosen by the application (eg, all the players in 
+   * an MD_MIDIGroup before processing their events). Nothing is read for files played 
+   * from memory, compiled event streams or in pipeline mode.
+   *
+   * \sa MD_MIDIGroup
+   *
+   * \param low the number of bytes left in a track buffer below which it is topped up.
+   * \return the number of tracks read from the file.
+   */
+  uint8_t prefetch(uint16_t low);
   /** @} */
 
   //--------------------------------------------------------------
@@ -1106,16 +2366,126 @@ public:
    * - process one event from each track and cycling through all tracks round robin fashion 
    * until no events are left to be processed (EVENT_PRIORITY).
    *
-   * The TRACK_PRIORITY define selects which is used. In practice there is little or no
-   * difference between the two methods.
+   * The TRACK_PRIORITY define selects which is used by default. In practice there is little 
+   * or no difference between the two methods. When several ticks are processed in one call
+   * events from different tracks may be processed out of time order, so setScheduler() 
+   * can also select strict time ordering (SCHED_TIME).
    *
    * Each MIDI and SYSEX event is passed back to the calling program for processing though the 
    * callback functions set up by setMidiHandler() and setSysexHandler().
+   *
+   * The work done in one call can be limited using setProcessBudget(). If the budget runs 
+   * out the events left are processed by the next call, starting with the track that was 
+   * interrupted, and this method returns true. Call it again with 0 ticks to carry on 
+   * without moving the song position.
    * 
+   * \sa setProcessBudget(), isPending()
+   *
    * \param ticks the number of ticks since the last call to this method.
-   * \return No return data
+   * \return true if events due are still waiting to be processed.
+   */
+  bool processEvents(uint16_t ticks);
+
+  /** 
+   * Limit the work done by each call to processEvents()
+   *
+   * Dense passages can have many events due at the same time. The budget limits how
+   * many events are processed, or how long is spent processing them, in each call to
+   * processEvents() (and so getNextEvent()), to bound the time taken away from the 
+   * rest of the application. Any events left over are processed at the next call, 
+   * before the events for later ticks. getNextEvent() carries on with these even when 
+   * no tick has passed and getMicrosToNextEvent() returns 0 while they are waiting.
+   *
+   * At least one event is always processed. Processing stops when either limit is 
+   * reached. The default is no limit.
+   *
+   * \sa processEvents(), isPending()
+   *
+   * \param events the most events processed in each call, 0 for no limit.
+   * \param us     the most time spent in each call in microseconds, 0 for no limit.
+   * \return No return data.
+   */
+  void setProcessBudget(uint16_t events, uint32_t us);
+
+  /** 
+   * Check if the budget ran out before all the events due were processed
+   *
+   * \sa setProcessBudget()
+   *
+   * \return true if events due are still waiting to be processed.
+   */
+  inline bool isPending(void) { return(_pending); }
+
+  /** 
+   * Get the time until the next event is due
+   *
+   * Works out how long it will be before getNextEvent() has an event to process,
+   * taking into account the current tempo and the time already elapsed since the 
+   * last tick. The application can sleep, yield to other tasks or set a timer for 
+   * this time instead of calling getNextEvent() continuously. The time is only valid 
+   * until the tempo is changed or the file is repositioned.
+   *
+   * Returns 0 if an event is already due or playback has not yet been synchronized, 
+   * so getNextEvent() should be called straight away.
+   *
+   * \sa getNextEvent()
+   *
+   * \return the number of microseconds until the next event, UINT32_MAX if paused or there are no more events.
+   */
+  uint32_t getMicrosToNextEvent(void);
+
+  /** 
+   * Get the events due in the next time window
+   *
+   * This is an alternative to getNextEvent() for applications that buffer their output
+   * ahead of time. All the events due up to windowMs milliseconds from now are read
+   * from the file, in time order, and returned with the micros() time they are due. 
+   * Events are returned only once, so the next call continues with the events after 
+   * the last one returned. Calling this method often with a window longer than the 
+   * time between calls keeps the output buffer full.
+   *
+   * MIDI and SYSEX events are returned in the buffer instead of being passed to the 
+   * callbacks. META events are processed as they are read (so tempo changes are 
+   * included in the event times) and passed to the META callback straight away.
+   *
+   * The clock starts at the first call, and is adjusted for pause(). getNextEvent() 
+   * must not be used at the same time. Compiled event streams are not supported.
+   *
+   * \sa getNextEvent(), isEOF()
+   *
+   * \param windowMs the time window in milliseconds.
+   * \param buf      pointer to the array of events to fill in.
+   * \param size     the number of events that buf can hold.
+   * \return the number of events placed in buf.
+   */
+  uint16_t getEventWindow(uint32_t windowMs, timed_event *buf, uint16_t size);
+
+  /** 
+   * Set the order events are processed
+   *
+   * Selects how processEvents() orders the events that are due. SCHED_TRACK and
+   * SCHED_EVENT are the same as the TRACK_PRIORITY and EVENT_PRIORITY options. 
+   * SCHED_TIME keeps the tracks in a priority queue ordered on the time of their 
+   * next event, so all events are processed in time order. Events due on the same 
+   * tick are processed in track order.
+   *
+   * The default is set by the TRACK_PRIORITY define.
+   *
+   * \sa getScheduler(), processEvents()
+   *
+   * \param mode one of the scheduler_t values.
+   * \return No return data.
    */
-  void processEvents(uint16_t ticks);
+  void setScheduler(scheduler_t mode);
+
+  /** 
+   * Get the order events are processed
+   *
+   * \sa setScheduler()
+   *
+   * \return the current scheduler_t value.
+   */
+  inline scheduler_t getScheduler(void) { return(_scheduler); }
 
  /** 
    * Set the MIDI callback function
@@ -1149,6 +2519,44 @@ public:
    */
   inline void setSysexHandler(void (*sh)(sysex_event *pev)) { _sysexHandler = sh; };
 
+  /** 
+   * Set the SYSEX chunk callback function
+   *
+   * SYSEX events passed to the callback set by setSysexHandler() are truncated to the
+   * size of the sysex_event data. When this callback is set, SYSEX events of any size 
+   * are passed to it instead, as a series of chunks pointing directly into the track 
+   * buffer, without copying. The chunks are at most MIDI_TRACK_BUFFER_SIZE bytes when 
+   * streaming from a file.
+   *
+   * The callback function has one parameter of type sysex_chunk. The first and last 
+   * members mark the start and end of each SYSEX event. The data pointer is only valid
+   * until the function returns.
+   *
+   * getEventWindow() still returns the SYSEX events as sysex_event structures. Set the
+   * callback to nullptr to return to using the SYSEX callback.
+   * 
+   * \param sh  the address of the function to be called from the library.
+   * \return No return data
+   */
+  inline void setSysexChunkHandler(void (*sh)(const sysex_chunk *pch)) { _sysexChunkHandler = sh; };
+
+  /** 
+   * Set the MIDI output encoder
+   *
+   * MIDI and SYSEX events are encoded to the output (see MD_MIDIOut) as well as being 
+   * passed to any callbacks that are set. The encoded bytes are written to the port 
+   * after each call to getNextEvent() or processEvents(), and after the notes are turned
+   * off by flushActiveNotes() and the controllers are sent by a seek.
+   *
+   * When no SYSEX callback is set, SYSEX events of any size are encoded in chunks as 
+   * they are read from the file. Otherwise they are encoded from the sysex_event passed
+   * to the callback and are limited to its size.
+   *
+   * \param out pointer to the encoder, nullptr for none.
+   * \return No return data
+   */
+  inline void setMidiOutput(MD_MIDIOut *out) { _midiOut = out; };
+
   /** 
    * Set the META callback function
    *
@@ -1166,6 +2574,122 @@ public:
   inline void setMetaHandler(void (*mh)(const meta_event *mev)) { _metaHandler = mh; };
   /** @} */
 
+  //--------------------------------------------------------------
+  /** \name Methods for timer driven playback
+   * @{
+   */
+  /** 
+   * Start timer driven playback
+   *
+   * Instead of calling getNextEvent() from loop(), the library sets a timer for the 
+   * time the next event is due (see getMicrosToNextEvent()) and processes the events 
+   * from the timer, so the event timing does not depend on the rest of the application.
+   * On the ESP32 this is an esp_timer and the callbacks are invoked from the esp_timer 
+   * task. On a POSIX host a thread sleeps with clock_nanosleep(). Other platforms do 
+   * not support timer driven playback.
+   *
+   * Playback stops by itself at the end of the file (unless looping). While the timer 
+   * is running getNextEvent() must not be called and the file should not be changed. 
+   * Call stopTimer() before close() or load().
+   *
+   * \sa stopTimer(), isTimerRunning(), setLatenessHandler()
+   *
+   * \return true if the timer was started.
+   */
+  bool startTimer(void);
+
+  /** 
+   * Stop timer driven playback
+   *
+   * Waits for any events being processed by the timer to finish.
+   *
+   * \sa startTimer()
+   *
+   * \return No return data.
+   */
+  void stopTimer(void);
+
+  /** 
+   * Check if timer driven playback is running
+   *
+   * \return true if the timer is running, false if stopped or the end of the file was reached.
+   */
+  inline bool isTimerRunning(void) { return(_timerRunning); }
+
+  /** 
+   * Get the timer playback statistics
+   *
+   * The statistics are reset by startTimer().
+   *
+   * \param s pointer to the structure to fill in.
+   * \return No return data.
+   */
+  inline void getTimerStats(timer_stats *s) { *s = _timerStats; }
+
+  /** 
+   * Set the lateness callback function
+   *
+   * The callback function is called from the timer after the events due have been 
+   * processed, with the number of microseconds the dispatch was after its scheduled 
+   * time. It is called in the same context as the event callbacks.
+   * 
+   * \param lh  the address of the function to be called from the library.
+   * \return No return data
+   */
+  inline void setLatenessHandler(void (*lh)(uint32_t late)) { _lateHandler = lh; };
+  /** @} */
+
+  //--------------------------------------------------------------
+  /** \name Methods for pipeline playback
+   * @{
+   */
+  /** 
+   * Start pipeline playback
+   *
+   * In pipeline mode the SMF is decoded by a separate task that reads the tracks 
+   * ahead of playback (see MIDI_PIPE_AHEAD) into a lock-free queue of timed events, 
+   * as getEventWindow() does. getNextEvent() then only takes the events that are due 
+   * from the queue and passes them to the MIDI and SYSEX callbacks, so a slow file 
+   * system read does not delay playback. On the ESP32 the decoder is a FreeRTOS task 
+   * on core MIDI_PIPE_CORE, away from loop(). On a POSIX host it is a thread. Other 
+   * platforms do not support pipeline playback.
+   *
+   * The clock starts when the pipeline is started. getNextEvent(), getMicrosToNextEvent(), 
+   * isEOF() and pause() work as normal, and startTimer() can be used for the playback 
+   * side. META events are passed to the META callback by the decoder task when they 
+   * are read, ahead of time. SYSEX events are truncated to the sysex_event data, as the 
+   * chunk callback is not used. Looping continues seamlessly.
+   *
+   * While the pipeline is running the file should not be changed, restarted or sought.
+   * Call stopPipeline() first. close() stops the pipeline.
+   *
+   * \sa stopPipeline(), isPipelineRunning(), getEventWindow()
+   *
+   * \return true if the pipeline was started.
+   */
+  bool startPipeline(void);
+
+  /** 
+   * Stop pipeline playback
+   *
+   * Waits for the decoder task to finish and discards the events still in the queue. 
+   * The tracks have been read past these, so call restart() or seek to a song position 
+   * before playing the file again.
+   *
+   * \sa startPipeline()
+   *
+   * \return No return data.
+   */
+  void stopPipeline(void);
+
+  /** 
+   * Check if pipeline playback is running
+   *
+   * \return true if the pipeline is running.
+   */
+  inline bool isPipelineRunning(void) { return(_pipe != nullptr); }
+  /** @} */
+
   //--------------------------------------------------------------
   /** \name Methods for debugging
    * @{
@@ -1185,11 +2709,124 @@ protected:
   void    calcTickTime(void); ///< called internally to update the tick time when parameters change
   void    initialise(void);   ///< initialize class variables all in one place
   void    synchTracks(void);  ///< synchronize the start of all tracks
+  uint16_t fillWindow(uint32_t horizon, timed_event *buf, uint16_t size); ///< read the events due up to horizon into buf
+  void    applyTransport(bool decoder); ///< apply the transport commands posted for playback or the pipeline decoder
+
+  /** update the active note table from a MIDI event passed to the callback */
+  inline void activeNote(const midi_event *pev)
+  {
+    if ((pev->data[0] & 0xe0) == 0x80)    // note off or note on
+    {
+      uint32_t *p = &_activeNote[pev->channel & 0xf][(pev->data[1] & 0x7f) >> 5];
+      uint32_t bit = 1UL << (pev->data[1] & 31);
+      uint32_t on = (pev->data[0] == 0x90 && pev->data[2] != 0) ? bit : 0;
+
+      *p = (*p & ~bit) | on;    // without a branch, note on and off are not predictable
+    }
+  }
   uint16_t tickClock(void);   ///< work out the number of ticks since the last event check
+  bool    loadMemory(void);   ///< read the whole file into memory and play the tracks from there
+  void    processMeta(meta_event *mev); ///< act on a META event and pass it to the callback
+  template <class S> int loadChunks(S *src); ///< read the SMF header and track chunks from the source
+
+  // compiled event stream playback
+  int     loadDev(void);      ///< read the compiled event stream header
+  void    devRestart(void);   ///< rewind the compiled event stream
+  bool    devPeek(void);      ///< read the next record if not already pending
+  void    devData(uint8_t *data, uint16_t size, uint16_t len); ///< read SYSEX/META record data
+  void    devDispatch(void);  ///< pass the pending record to the callbacks
+  bool    devProcess(bool useTicks, uint32_t now); ///< dispatch all records due by now
+  void    releaseMemory(void); ///< release the memory image of the file
+  int     allocTracks(uint16_t count); ///< allocate the data for count tracks
+  void    releaseTracks(void);  ///< release the track data
+  void    dispatchMidi(midi_event *pev);   ///< pass a MIDI event to the callback or the event window
+  void    dispatchSysex(sysex_event *pev); ///< pass a SYSEX event to the callback or the event window
+  inline bool sysexChunked(void) { return((_sysexChunkHandler != nullptr || (_midiOut != nullptr && _sysexHandler == nullptr)) && _window == nullptr && !_seeking); } ///< true if SYSEX events are passed in chunks
+
+  // event output
+  /** pass a MIDI event to the output and the callback */
+  inline void sendMidi(midi_event *pev)
+  {
+    if (_midiHandler == nullptr && _midiOut == nullptr)
+      return;
+    activeNote(pev);
+    if (_midiOut != nullptr) _midiOut->midi(pev);
+    if (_midiHandler != nullptr) (_midiHandler)(pev);
+  }
+  void    sendSysex(sysex_event *pev);  ///< pass a SYSEX event to the output and the callback
+  void    sendSysexChunk(const sysex_chunk *pch); ///< pass a SYSEX chunk to the output and the callback
+  inline void flushOutput(void) { if (_midiOut != nullptr) _midiOut->flush(); } ///< write the encoded events to the port
+
+  // processing budget
+  void    budgetStart(void);    ///< start counting the budget for this call
+  bool    budgetLeft(void);     ///< count an event processed, false when the budget has run out
+
+  // time ordered scheduler
+  void    heapBuild(void);      ///< put all the active tracks into the priority queue
+  void    heapDown(uint8_t pos); ///< restore the priority queue order from pos down
+  void    processTimeOrder(void); ///< process the events due in time order
+
+  // seek index
+  void    releaseIndex(void);   ///< release the seek index memory
+  int     loadIndex(const char *idxName, uint32_t size, uint32_t mtime); ///< read the seek index from a file
+  int     saveIndex(const char *idxName, uint32_t size, uint32_t mtime); ///< write the seek index to a file
+  void    rewindTracks(void);   ///< restart all the tracks, including track 0
+  uint32_t nextDueTick(void);   ///< the earliest due tick for all tracks, UINT32_MAX if none
+  void    processDue(uint32_t tick); ///< process all the events due by tick
+  bool    seekPosition(int32_t cp, uint32_t target, bool byTime); ///< seek from checkpoint cp to the target
+  void    chaseEvent(const midi_event *pev); ///< update the chase state from a skipped event
+  void    chaseRestore(void);   ///< send the chase state to the MIDI callback
+  void    releaseTempoMap(void); ///< release the tempo map memory
 
   void (*_midiHandler)(midi_event *pev);   ///< callback into user code to process MIDI stream
   void (*_sysexHandler)(sysex_event *pev); ///< callback into user code to process SYSEX stream
+  void (*_sysexChunkHandler)(const sysex_chunk *pch); ///< callback into user code to process SYSEX stream in chunks
   void (*_metaHandler)(const meta_event *pev); ///< callback into user code to process META stream
+  void (*_lateHandler)(uint32_t late);         ///< callback into user code to report timer lateness
+  MD_MIDIOut *_midiOut;         ///< output encoder for MIDI and SYSEX events, nullptr if none
+
+  // timer driven playback
+  uint32_t timerDispatch(void); ///< process the events due and return the time to the next, UINT32_MAX to stop
+  std::atomic<bool> _timerRunning; ///< true while the timer playback is active
+  uint32_t  _timerDue;          ///< micros() time the next event is due
+  bool      _timerDueSet;       ///< true if _timerDue holds the time of an event
+  timer_stats _timerStats;      ///< lateness statistics
+#if MIDI_TIMER_ESP32
+  esp_timer_handle_t _timer;    ///< the esp_timer used for playback
+  std::atomic<bool> _timerBusy; ///< true while the timer callback is running
+  friend void mdTimerCallback(void *arg);
+#elif MIDI_TIMER_POSIX
+  pthread_t _timerThread;       ///< the playback thread
+  bool      _timerJoin;         ///< true if the playback thread needs to be joined
+  friend void *mdTimerThread(void *arg);
+#endif
+
+  // notes sounding
+  uint32_t  _activeNote[16][128 / 32];  ///< bit set for each note on, by channel
+
+  // transport commands from other tasks
+  std::atomic<uint8_t> _ctlPending;  ///< one bit for each transport_t command waiting
+  std::atomic<int32_t> _ctlValue[TRANSPORT_SEEK_MICROS + 1]; ///< the last value posted for each command
+
+  // pipeline playback
+  timed_event *_pipe;           ///< event queue between the decoder and playback, nullptr if not running
+#if MIDI_TIMER_ESP32 || MIDI_TIMER_POSIX
+  bool    pipeDispatch(void);   ///< pass the events due from the queue to the callbacks
+  uint32_t pipeWait(void);      ///< microseconds to the next event in the queue
+  bool    pipeDecode(void);     ///< decoder task work, returns false when the task should stop
+  std::atomic<uint16_t> _pipeHead;  ///< count of events added to the queue by the decoder
+  std::atomic<uint16_t> _pipeTail;  ///< count of events taken from the queue by playback
+  std::atomic<uint32_t> _pipeShift; ///< total pause time, added to the event times
+  std::atomic<bool> _pipeRunning;   ///< true while the decoder task should run
+  std::atomic<bool> _pipeDone;      ///< true when the decoder has read the whole file
+#if MIDI_TIMER_ESP32
+  std::atomic<bool> _pipeTaskDone;  ///< true when the decoder task has finished
+  friend void mdPipeTask(void *arg);
+#else
+  pthread_t _pipeThread;        ///< the decoder thread
+  friend void *mdPipeThread(void *arg);
+#endif
+#endif
 
   const char *_fileName;      ///< MIDI file name buffer in user code
 
@@ -1197,9 +2834,17 @@ protected:
   uint8_t _trackCount;        ///< number of tracks in file
 
   uint16_t  _ticksPerQuarterNote; ///< time base of file
-  uint32_t  _tickTime;            ///< calculated per tick based on other data for MIDI file
-  uint16_t  _lastTickError;       ///< error brought forward from last tick check
+  uint32_t  _tickTime;            ///< calculated per tick based on other data for MIDI file, whole microseconds
+  uint64_t  _tickTimeFP;          ///< microseconds per tick in 32.32 fixed point
+  uint64_t  _lastTickError;       ///< part tick brought forward from last tick check in 32.32 fixed point
+  uint32_t  _usPerQN;             ///< exact microseconds per quarter note from the SMF
+  uint32_t  _usPerQNAdj;          ///< microseconds per quarter note including the tempo adjustment
+  uint64_t  _songRateFP;          ///< song microseconds per real microsecond (_usPerQN / _usPerQNAdj) in 32.32 fixed point
+  uint64_t  _songTimeNum;         ///< song time of the ticks played multiplied by _ticksPerQuarterNote
+  uint32_t  _playTime;            ///< microseconds of playback since the tracks were synchronized
+  uint32_t  _playTicks;           ///< ticks counted by tickClock() since the tracks were synchronized
   uint32_t  _lastTickCheckTime;   ///< the last time (microsec) an tick check was performed
+  uint32_t  _tickCount;           ///< ticks elapsed since the start of playback
 
   bool    _synchDone;             ///< sync up at the start of all tracks
   bool    _paused;                ///< if true we are currently paused
@@ -1213,8 +2858,185 @@ protected:
   // file handling
   uint8_t   _selectSD;          ///< SDFat select line
   SDFAT     *_sd;                ///< SDFat library descriptor supplied by calling program
-  SDFILE    _fd;                ///< SDFat file descriptor
-  MD_MFTrack   _track[MIDI_MAX_TRACKS]; ///< the track data for this file
+  MD_MFSource _fd;              ///< byte source for the SMF file
+
+  // memory image of the file
+  loadMode_t _loadMode;         ///< how the next file will be loaded
+  uint32_t  _loadBudget;        ///< largest file that will be loaded into memory
+  uint8_t   *_userBuf;          ///< user buffer for LOAD_BUFFER
+  const uint8_t *_image;        ///< memory image of the current file, nullptr if streaming
+  bool      _imageOwned;        ///< true if _image was allocated by the library
+
+  // compiled event stream
+  bool      _devMode;           ///< true if playing a compiled event stream
+  bool      _devPending;        ///< true if _devRec holds the next record to process
+  uint32_t  _devRecords;        ///< total number of records in the stream
+  uint32_t  _devIndex;          ///< number of records read so far
+  uint64_t  _devTimeFP;         ///< current playback time in 32.32 fixed point microseconds
+  mdev_record _devRec;          ///< the next record to process
+
+  // lookahead event window
+  timed_event *_window;         ///< buffer being filled by getEventWindow(), nullptr otherwise
+  uint16_t  _windowCount;       ///< number of events in _window
+  uint16_t  _windowSize;        ///< size of _window
+  uint32_t  _windowTick;        ///< tick of the last event read into the window
+  uint64_t  _windowTime;        ///< micros() time of _windowTick in 32.32 fixed point
+  uint32_t  _pauseTime;         ///< micros() time pause() started
+
+  // processing budget
+  uint16_t  _budgetEvents;      ///< most events in each processEvents() call, 0 for no limit
+  uint32_t  _budgetMicros;      ///< most microseconds in each processEvents() call, 0 for no limit
+  uint16_t  _budgetUsed;        ///< events processed in this call
+  uint32_t  _budgetStart;       ///< micros() time this call started
+  bool      _pending;           ///< true if the budget ran out with events still due
+  uint8_t   _resumeTrack;       ///< the track to start with at the next call
+
+  // time ordered scheduler
+  /** Priority queue entry for a track */
+  typedef struct
+  {
+    uint32_t due;               ///< tick the next event on the track is due
+    uint8_t track;              ///< the track index
+  } sched_entry;
+
+  scheduler_t _scheduler;       ///< how events are ordered by processEvents()
+  bool      _heapValid;         ///< false when the priority queue needs to be rebuilt
+  uint8_t   _heapCount;         ///< number of tracks in the priority queue
+  sched_entry *_heap;           ///< binary min-heap of the tracks with events left, one entry for each track
+
+  // seek index
+  bool      _seeking;           ///< true while replaying events silently, callbacks are not invoked
+  uint32_t  _idxCount;          ///< number of checkpoints in the index
+  uint32_t  _idxInterval;       ///< ticks between checkpoints
+  index_point *_idxPoint;       ///< song position for each checkpoint
+  track_checkpoint *_idxTrack;  ///< track states, _trackCount for each checkpoint
+  bool      _chaseMode;         ///< true if seeking collects the channel controller state
+  chase_state _chase[16];       ///< controller state for each MIDI channel while chasing
+
+  // tempo map
+  bool      _tmapAuto;          ///< true if load() builds the tempo map
+  uint32_t  _tmapCount;         ///< number of entries in the tempo map
+  uint32_t  _tmapEndTick;       ///< tick of the last event in the file
+  tempo_point *_tmap;           ///< the tempo changes in song order
+
+  // track data
+  void      *_arena;            ///< user memory for the tracks, nullptr to use the heap
+  uint32_t  _arenaSize;         ///< size of the _arena
+  uint8_t   _trackAlloc;        ///< number of tracks allocated
+  bool      _trackOwned;        ///< true if the track memory was allocated from the heap
+  MD_MFTrack *_track;           ///< the track data for this file, _trackAlloc tracks
+  uint32_t  *_trackDue;         ///< next due tick published by each track, for scanning (see MD_MFTrack::setDueSlot())
+};
+
+/**
+ * Several MD_MIDIFile objects played from one loop
+ *
+ * The group plays up to MIDI_GROUP_SIZE players (eg, a backing track with a click 
+ * track, or independent songs on different outputs) with a shared I/O scheduler. Each 
+ * call to getNextEvent() first tops up the track buffers of all the players together
+ * (see MD_MIDIFile::prefetch()), then processes the events due for each player, within 
+ * a share of the group processing budget.
+ *
+ * \sa \ref pageLibrary
+ */
+class MD_MIDIGroup
+{
+public:
+  /** 
+   * Class Constructor
+   *
+   * Instantiate a new, empty, group with no processing budget and topping up the 
+   * track buffers when they are a quarter full.
+   */
+  MD_MIDIGroup(void);
+
+  /** 
+   * Add a player to the group
+   *
+   * The player keeps its own file, callbacks and settings. The group sets its 
+   * processing budget (see setProcessBudget()).
+   *
+   * \param mf pointer to the player.
+   * \return false if the group is full or the player is already in it.
+   */
+  bool add(MD_MIDIFile *mf);
+
+  /** 
+   * Remove a player from the group
+   *
+   * \param mf pointer to the player.
+   * \return No return data.
+   */
+  void remove(MD_MIDIFile *mf);
+
+  /** 
+   * Get the number of players in the group
+   *
+   * \return the number of players.
+   */
+  inline uint8_t getCount(void) { return(_count); }
+
+  /** 
+   * Limit the work done by each call to getNextEvent()
+   *
+   * The budget is shared equally between the players (see MD_MIDIFile::setProcessBudget()),
+   * so the time spent processing events in each call does not depend on the number of 
+   * players or how busy the songs are. 0 is no limit.
+   *
+   * \param events the most events processed for all the players together.
+   * \param us     the most microseconds spent processing events for all the players together.
+   * \return No return data.
+   */
+  void setProcessBudget(uint16_t events, uint32_t us);
+
+  /** 
+   * Set when the track buffers are topped up
+   *
+   * \sa MD_MIDIFile::prefetch()
+   *
+   * \param low the number of bytes left in a track buffer below which it is topped up.
+   * \return No return data.
+   */
+  inline void setPrefetch(uint16_t low) { _prefetchLow = low; }
+
+  /** 
+   * Play the group
+   *
+   * Tops up the track buffers of all the players, then calls getNextEvent() for each 
+   * player. The first player processed changes with each call, so none is always last.
+   * Call this method from loop() in place of MD_MIDIFile::getNextEvent().
+   *
+   * \return the number of players that processed events.
+   */
+  uint8_t getNextEvent(void);
+
+  /** 
+   * Time to the next event due in the group
+   *
+   * \sa MD_MIDIFile::getMicrosToNextEvent()
+   *
+   * \return the number of microseconds until the first player has an event due, UINT32_MAX if none.
+   */
+  uint32_t getMicrosToNextEvent(void);
+
+  /** 
+   * Check if all the players have finished
+   *
+   * \sa MD_MIDIFile::isEOF()
+   *
+   * \return true if every player is at the end of its file.
+   */
+  bool isEOF(void);
+
+private:
+  void shareBudget(void);   ///< set the processing budget of each player
+
+  MD_MIDIFile *_player[MIDI_GROUP_SIZE]; ///< the players in the group
+  uint8_t   _count;         ///< number of players in the group
+  uint8_t   _first;         ///< player processed first by the next getNextEvent()
+  uint16_t  _prefetchLow;   ///< top up track buffers with fewer bytes than this left
+  uint16_t  _budgetEvents;  ///< group event budget, 0 for no limit
+  uint32_t  _budgetMicros;  ///< group time budget, 0 for no limit
 };
 
 #endif /* _MDMIDIFILE_H */
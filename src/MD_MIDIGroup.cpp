@@ -0,0 +1,142 @@
+/*
+  MD_MIDIGroup.cpp - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "MD_MIDIFileSPIFF.h"
+
+/**
+ * \file
+ * \brief Main file for the MD_MIDIGroup class implementation
+ */
+
+MD_MIDIGroup::MD_MIDIGroup(void)
+{
+  _count = _first = 0;
+  _budgetEvents = 0;
+  _budgetMicros = 0;
+  setPrefetch(MIDI_TRACK_BUFFER_SIZE / 4);
+}
+
+bool MD_MIDIGroup::add(MD_MIDIFile *mf)
+{
+  if (mf == nullptr || _count >= MIDI_GROUP_SIZE)
+    return(false);
+
+  for (uint8_t i = 0; i < _count; i++)
+    if (_player[i] == mf)
+      return(false);
+
+  _player[_count++] = mf;
+  shareBudget();
+
+  return(true);
+}
+
+void MD_MIDIGroup::remove(MD_MIDIFile *mf)
+{
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    if (_player[i] == mf)
+    {
+      // keep the others in the same order
+      for (uint8_t j = i + 1; j < _count; j++)
+        _player[j - 1] = _player[j];
+      _count--;
+      if (_first >= _count) _first = 0;
+
+      mf->setProcessBudget(0, 0);
+      shareBudget();
+      break;
+    }
+  }
+}
+
+void MD_MIDIGroup::setProcessBudget(uint16_t events, uint32_t us)
+{
+  _budgetEvents = events;
+  _budgetMicros = us;
+  shareBudget();
+}
+
+void MD_MIDIGroup::shareBudget(void)
+// Equal shares, at least one event each so every player makes progress
+{
+  uint16_t events;
+  uint32_t us;
+
+  if (_count == 0)
+    return;
+
+  events = _budgetEvents / _count;
+  if (_budgetEvents != 0 && events == 0) events = 1;
+  us = _budgetMicros / _count;
+  if (_budgetMicros != 0 && us == 0) us = 1;
+
+  for (uint8_t i = 0; i < _count; i++)
+    _player[i]->setProcessBudget(events, us);
+}
+
+uint8_t MD_MIDIGroup::getNextEvent(void)
+{
+  uint8_t n = 0;
+
+  if (_count == 0)
+    return(0);
+
+  // all the file reads together, before any events are processed
+  for (uint8_t i = 0; i < _count; i++)
+    _player[i]->prefetch(_prefetchLow);
+
+  // then the events, starting with a different player each time
+  for (uint8_t i = 0; i < _count; i++)
+  {
+    uint8_t p = _first + i;
+
+    if (p >= _count) p -= _count;
+    if (_player[p]->getNextEvent())
+      n++;
+  }
+  if (++_first >= _count) _first = 0;
+
+  return(n);
+}
+
+uint32_t MD_MIDIGroup::getMicrosToNextEvent(void)
+{
+  uint32_t wait = UINT32_MAX;
+
+  for (uint8_t i = 0; i < _count && wait != 0; i++)
+  {
+    uint32_t w = _player[i]->getMicrosToNextEvent();
+
+    if (w < wait) wait = w;
+  }
+
+  return(wait);
+}
+
+bool MD_MIDIGroup::isEOF(void)
+{
+  for (uint8_t i = 0; i < _count; i++)
+    if (!_player[i]->isEOF())
+      return(false);
+
+  return(true);
+}
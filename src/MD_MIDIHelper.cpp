@@ -30,34 +30,6 @@
  * \brief Main file for helper functions implementation
  */
 
-uint32_t readMultiByte(SDFILE *f, uint8_t nLen)
-// read fixed length parameter from input
-{
-  uint32_t  value = 0L;
-  
-  for (uint8_t i=0; i<nLen; i++)
-  {
-    value = (value << 8) + f->read();
-  }
-  
-  return(value);
-}
-
-uint32_t readVarLen(SDFILE *f)
-// read variable length parameter from input
-{
-  uint32_t  value = 0;
-  char      c;
-  
-  do
-  {
-    c = f->read();
-    value = (value << 7) + (c & 0x7f);
-  }  while (c & 0x80);
-  
-  return(value);
-}
-
 #if DUMP_DATA
 void dumpBuffer(uint8_t *p, int len)
 // Formatted dump of a buffer of data
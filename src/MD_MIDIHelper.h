@@ -34,6 +34,17 @@
 #define MTRK_HDR      "MTrk"    ///< SMF track header marker
 #define MTRK_HDR_SIZE 4         ///< SMF track header marker length
 
+// Compiled event stream file
+#define MDEV_HDR      "MDev"    ///< compiled event stream marker
+#define MDEV_HDR_SIZE 32        ///< compiled event stream header length
+#define MDEV_REC_SIZE 12        ///< compiled event stream record length
+#define MDEV_VERSION  1         ///< compiled event stream format version
+
+// Seek index file
+#define MIDX_HDR      "MIdx"    ///< seek index marker
+#define MIDX_HDR_SIZE 24        ///< seek index header length
+#define MIDX_VERSION  1         ///< seek index format version
+
 #define BUF_SIZE(x)   (sizeof(x)/sizeof(x[0]))  ///< Buffer size macro
 
 // readMultiByte() parameters
@@ -43,27 +54,66 @@
 #define MB_BYTE 1   ///< readMultibyte() parameter specifying expected 1 byte value
 
 // Function prototypes ----------------
+// Little endian storage for the fields in files created by the library
+inline void putLE16(uint8_t *p, uint16_t v) { p[0] = v & 0xff; p[1] = v >> 8; }  ///< store 2 bytes little endian
+inline void putLE32(uint8_t *p, uint32_t v) { putLE16(p, v & 0xffff); putLE16(p + 2, v >> 16); }  ///< store 4 bytes little endian
+inline uint16_t getLE16(const uint8_t *p) { return(p[0] | ((uint16_t)p[1] << 8)); }  ///< fetch 2 bytes little endian
+inline uint32_t getLE32(const uint8_t *p) { return(getLE16(p) | ((uint32_t)getLE16(p + 2) << 16)); }  ///< fetch 4 bytes little endian
+
 /**
  * Read a multi byte value from the input stream
  *
- * SMF contain numbers that are fixed length. This function reads these from the input file.
+ * SMF contain numbers that are fixed length. This function reads these from the input source.
+ *
+ * The source may be any object with a read() method returning the next byte, such as an
+ * SDFILE or one of the byte source classes in MD_MIDISource.h. As the source type is a 
+ * template parameter the read() call is resolved at compile time.
  * 
- * \param *f    pointer to SDFile object to use for reading.
+ * \param *f    pointer to the byte source object to use for reading.
  * \param nLen  one of MB_LONG, MB_TRYTE, MB_WORD, MB_BYTE to specify the number of bytes to read.
  * \return the value read as a 4 byte integer. This should be cast to the expected size if required.
  */
-uint32_t readMultiByte(SDFILE *f, uint8_t nLen);
+template <class S> uint32_t readMultiByte(S *f, uint8_t nLen)
+// read fixed length parameter from input
+{
+  uint32_t  value = 0L;
+  
+  for (uint8_t i=0; i<nLen; i++)
+  {
+    value = (value << 8) + (uint8_t)f->read();
+  }
+  
+  return(value);
+}
 
 /**
  * Read a variable length parameter from the input stream
  *
- * SMF contain numbers that are variable length, with the last byte of the number identified with bit 7 set.
- * This function reads these from the input file.
+ * SMF contain numbers that are variable length, with the last byte of the number identified with bit 7 clear.
+ * This function reads these from the input source, at most 4 bytes as allowed by the SMF specification.
+ *
+ * \sa readMultiByte() for the source requirements.
  *
- * \param *f    pointer to SDFile object to use for reading.
+ * \param *f    pointer to the byte source object to use for reading.
  * \return the value read as a 4 byte integer. This should be cast to the expected size if required.
  */
-uint32_t readVarLen(SDFILE *f);   
+template <class S> uint32_t readVarLen(S *f)
+// read variable length parameter from input
+{
+  uint32_t  value = 0;
+  uint8_t   c;
+  
+  // at most 4 bytes, so a corrupt or truncated file cannot loop forever
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    c = f->read();
+    value = (value << 7) + (c & 0x7f);
+    if ((c & 0x80) == 0)
+      break;
+  }
+  
+  return(value);
+}
 
 /** 
  * Dump a block of data stream
@@ -0,0 +1,633 @@
+/*
+  MD_MIDIIndex.cpp - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <string.h>
+#include <stdlib.h>
+#include "MD_MIDIFileSPIFF.h"
+#include "MD_MIDIHelper.h"
+
+/**
+ * \file
+ * \brief Main file for the seek index, tempo map, seek and chase methods
+ */
+
+// Number of checkpoints added each time the index needs more memory
+#define IDX_ALLOC_STEP  16
+
+// Number of tempo map entries added each time the map needs more memory
+#define TMAP_ALLOC_STEP 8
+
+void MD_MIDIFile::releaseIndex(void)
+{
+  free(_idxPoint);
+  free(_idxTrack);
+  _idxPoint = nullptr;
+  _idxTrack = nullptr;
+  _idxCount = 0;
+}
+
+void MD_MIDIFile::rewindTracks(void)
+// Unlike restart(), track 0 is always rewound
+{
+  for (uint8_t i = 0; i < _trackCount; i++)
+    _track[i].restart();
+}
+
+uint32_t MD_MIDIFile::nextDueTick(void)
+// Earliest tick with an event waiting in any track
+{
+  uint32_t next = UINT32_MAX;
+
+  for (uint8_t i = 0; i < _trackCount; i++)
+  {
+    if (_trackDue[i] == 0)    // the DeltaT may not be decoded yet
+      _track[i].getDueTick(this);
+    if (_trackDue[i] < next)
+      next = _trackDue[i];
+  }
+
+  return(next);
+}
+
+void MD_MIDIFile::processDue(uint32_t tick)
+// Process all the events in all the tracks up to tick
+{
+  _tickCount = tick;
+  for (uint8_t i = 0; i < _trackCount; i++)
+    while (_track[i].getNextEvent(this))
+      ;   // nothing else to do
+}
+
+int MD_MIDIFile::buildIndex(uint32_t interval, const char *idxName)
+{
+  uint32_t  size = 0, mtime = 0;
+  uint32_t  allocated = 0;
+  uint32_t  tick = 0, next;
+  uint64_t  time = 0;         // 32.32 fixed point microseconds
+  int16_t   delta = _tempoDelta;
+  uint32_t  usPerQN = _usPerQN;
+  uint8_t   timeSig[2] = { _timeSignature[0], _timeSignature[1] };
+  int       err = E_OK;
+
+  if (_devMode || _trackCount == 0)
+    return(E_NO_FILE);
+
+  releaseIndex();
+
+  // the file details are used to check a saved index matches the SMF
+  if ((idxName != nullptr) && (*idxName != '\0') && (*_fileName != '\0'))
+  {
+    MD_MFSource f;
+
+    if (f.open(_fileName))
+    {
+      size = f.size();
+      mtime = f.mtime();
+      f.close();
+
+      if (loadIndex(idxName, size, mtime) == E_OK)
+        return(E_OK);
+    }
+  }
+
+  if (interval == 0)
+    interval = (uint32_t)MIDI_INDEX_INTERVAL * _ticksPerQuarterNote;
+  if (interval == 0)
+    interval = 1;
+  _idxInterval = interval;
+
+  // play the whole file silently, saving a checkpoint every interval ticks
+  _tempoDelta = 0;    // song time does not include the tempo adjustment
+  calcTickTime();
+  rewindTracks();
+  _seeking = true;
+
+  do
+  {
+    next = nextDueTick();
+
+    // checkpoints up to the next event hold the state before it is processed
+    while ((next != UINT32_MAX) && ((uint64_t)_idxCount * interval <= next))
+    {
+      index_point *p;
+
+      if (_idxCount == allocated)
+      {
+        index_point *ip = (index_point *)realloc(_idxPoint, (allocated + IDX_ALLOC_STEP) * sizeof(index_point));
+        if (ip != nullptr) _idxPoint = ip;
+        track_checkpoint *tp = (track_checkpoint *)realloc(_idxTrack, (allocated + IDX_ALLOC_STEP) * _trackCount * sizeof(track_checkpoint));
+        if (tp != nullptr) _idxTrack = tp;
+
+        if (ip == nullptr || tp == nullptr)
+        {
+          err = E_NO_MEMORY;
+          break;
+        }
+        allocated += IDX_ALLOC_STEP;
+      }
+
+      p = &_idxPoint[_idxCount];
+      p->tick = _idxCount * interval;
+      p->time = (time + ((uint64_t)(p->tick - tick) * _tickTimeFP)) >> 32;
+      p->usPerQN = _usPerQN;
+      p->timeSig[0] = _timeSignature[0];
+      p->timeSig[1] = _timeSignature[1];
+      for (uint8_t i = 0; i < _trackCount; i++)
+        _track[i].getCheckpoint(this, &_idxTrack[(_idxCount * _trackCount) + i]);
+      _idxCount++;
+    }
+
+    if (next != UINT32_MAX && err == E_OK)
+    {
+      time += (uint64_t)(next - tick) * _tickTimeFP;
+      tick = next;
+      processDue(next);
+    }
+  } while (next != UINT32_MAX && err == E_OK);
+
+  // back to the start for playing
+  _seeking = false;
+  rewindTracks();
+  _tempoDelta = delta;
+  setTimeSignature(timeSig[0], timeSig[1]);
+  setMicrosecondPerQuarterNote(usPerQN);
+  _tickCount = 0;
+  _synchDone = false;
+
+  if (err != E_OK)
+  {
+    releaseIndex();
+    return(err);
+  }
+
+  DUMP("\nIndex checkpoints: ", _idxCount);
+
+  if (size != 0 || mtime != 0)
+    err = saveIndex(idxName, size, mtime);
+
+  return(err);
+}
+
+int MD_MIDIFile::loadIndex(const char *idxName, uint32_t size, uint32_t mtime)
+// Read an index file saved by saveIndex() for this SMF
+{
+  MD_MFSource f;
+  uint8_t hdr[MIDX_HDR_SIZE];
+  uint32_t count, nTrack;
+  int err = E_OK;
+
+  if (!f.open(idxName))
+    return(E_NO_OPEN);
+
+  if ((f.read(hdr, sizeof(hdr)) != sizeof(hdr)) ||
+    (memcmp(&hdr[0], MIDX_HDR, 4) != 0) ||
+    (getLE16(&hdr[4]) != MIDX_VERSION) ||
+    (hdr[6] != sizeof(index_point)) ||
+    (hdr[7] != sizeof(track_checkpoint)) ||
+    (getLE32(&hdr[8]) != size) ||
+    (getLE32(&hdr[12]) != mtime) ||
+    (hdr[20] != _trackCount))
+  {
+    f.close();
+    return(E_HEADER);
+  }
+
+  _idxInterval = getLE32(&hdr[16]);
+  count = getLE16(&hdr[22]);
+  nTrack = count * _trackCount;
+
+  _idxPoint = (index_point *)malloc(count * sizeof(index_point));
+  _idxTrack = (track_checkpoint *)malloc(nTrack * sizeof(track_checkpoint));
+  if (_idxPoint == nullptr || _idxTrack == nullptr)
+    err = E_NO_MEMORY;
+  else if ((f.read((uint8_t *)_idxPoint, count * sizeof(index_point)) != count * sizeof(index_point)) ||
+    (f.read((uint8_t *)_idxTrack, nTrack * sizeof(track_checkpoint)) != nTrack * sizeof(track_checkpoint)))
+    err = E_HEADER;
+  f.close();
+
+  if (err != E_OK)
+    releaseIndex();
+  else
+    _idxCount = count;
+
+  return(err);
+}
+
+int MD_MIDIFile::saveIndex(const char *idxName, uint32_t size, uint32_t mtime)
+// Write the index to a file with the details of the SMF it was built from.
+// The checkpoint structures are saved as they are in memory, so the file
+// is only valid on the same platform.
+{
+  MD_MFSource f;
+  uint8_t hdr[MIDX_HDR_SIZE];
+  uint32_t nTrack = _idxCount * _trackCount;
+  int err = E_OK;
+
+  if (_idxCount > 0xffff)   // too many to save, use a bigger interval
+    return(E_WRITE);
+
+  memset(hdr, 0, sizeof(hdr));
+  memcpy(&hdr[0], MIDX_HDR, 4);
+  putLE16(&hdr[4], MIDX_VERSION);
+  hdr[6] = sizeof(index_point);
+  hdr[7] = sizeof(track_checkpoint);
+  putLE32(&hdr[8], size);
+  putLE32(&hdr[12], mtime);
+  putLE32(&hdr[16], _idxInterval);
+  hdr[20] = _trackCount;
+  putLE16(&hdr[22], _idxCount);
+
+  if (!f.create(idxName))
+    return(E_WRITE);
+
+  if ((f.write(hdr, sizeof(hdr)) != sizeof(hdr)) ||
+    (f.write((uint8_t *)_idxPoint, _idxCount * sizeof(index_point)) != _idxCount * sizeof(index_point)) ||
+    (f.write((uint8_t *)_idxTrack, nTrack * sizeof(track_checkpoint)) != nTrack * sizeof(track_checkpoint)))
+    err = E_WRITE;
+  f.close();
+
+  return(err);
+}
+
+bool MD_MIDIFile::seekPosition(int32_t cp, uint32_t target, bool byTime)
+// Restore checkpoint cp (none if -1) and then silently play the events
+// before the target tick or time.
+{
+  uint32_t  tick = 0, next;
+  uint64_t  time = 0;         // 32.32 fixed point microseconds
+  int16_t   delta = _tempoDelta;
+
+  flushActiveNotes();
+
+  if (cp < 0)
+    rewindTracks();
+  else
+  {
+    index_point *p = &_idxPoint[cp];
+
+    for (uint8_t i = 0; i < _trackCount; i++)
+      _track[i].setCheckpoint(&_idxTrack[(cp * _trackCount) + i]);
+    setTimeSignature(p->timeSig[0], p->timeSig[1]);
+    setMicrosecondPerQuarterNote(p->usPerQN);
+    tick = p->tick;
+    time = (uint64_t)p->time << 32;
+  }
+
+  if (_chaseMode)
+    memset(_chase, 0xff, sizeof(_chase));
+
+  _tempoDelta = 0;    // song time does not include the tempo adjustment
+  calcTickTime();
+  _seeking = true;
+
+  while ((next = nextDueTick()) != UINT32_MAX)
+  {
+    uint64_t t = time + ((uint64_t)(next - tick) * _tickTimeFP);
+
+    if (byTime ? (t >= ((uint64_t)target << 32)) : (next >= target))
+      break;
+
+    time = t;
+    tick = next;
+    processDue(next);
+  }
+
+  _seeking = false;
+
+  if (_chaseMode)
+    chaseRestore();
+
+  // the position is between the last event processed and the next one
+  if (!byTime)
+    tick = target;
+  else if (_tickTimeFP != 0)
+    tick += (((uint64_t)target << 32) - time) / _tickTimeFP;
+
+  _tempoDelta = delta;
+  calcTickTime();
+
+  // carry on playing from here
+  _tickCount = tick;
+  _heapValid = false;
+  _pending = false;
+  _resumeTrack = 0;
+  _synchDone = true;
+  _lastTickCheckTime = micros();
+  _windowTick = _tickCount;   // event windows are timed from here too
+  _windowTime = (uint64_t)_lastTickCheckTime << 32;
+  _lastTickError = 0;
+  _songTimeNum = _playTime = _playTicks = 0;
+
+  return(true);
+}
+
+bool MD_MIDIFile::seekToTick(uint32_t tick)
+{
+  int32_t lo = 0, hi = (int32_t)_idxCount - 1, cp = -1;
+
+  if (_devMode || _trackCount == 0)
+    return(false);
+  if (_chaseMode)   // the controller state is only known from the start
+    hi = -1;
+
+  // binary search for the last checkpoint at or before the tick
+  while (lo <= hi)
+  {
+    int32_t mid = (lo + hi) / 2;
+
+    if (_idxPoint[mid].tick <= tick)
+    {
+      cp = mid;
+      lo = mid + 1;
+    }
+    else
+      hi = mid - 1;
+  }
+
+  return(seekPosition(cp, tick, false));
+}
+
+bool MD_MIDIFile::seekToMicros(uint32_t us)
+{
+  int32_t lo = 0, hi = (int32_t)_idxCount - 1, cp = -1;
+
+  if (_devMode || _trackCount == 0)
+    return(false);
+  if (_chaseMode)   // the controller state is only known from the start
+    hi = -1;
+
+  // binary search for the last checkpoint at or before the time
+  while (lo <= hi)
+  {
+    int32_t mid = (lo + hi) / 2;
+
+    if (_idxPoint[mid].time <= us)
+    {
+      cp = mid;
+      lo = mid + 1;
+    }
+    else
+      hi = mid - 1;
+  }
+
+  return(seekPosition(cp, us, true));
+}
+
+void MD_MIDIFile::chaseEvent(const midi_event *pev)
+// Keep the controller state changed by an event skipped while seeking
+{
+  chase_state *c = &_chase[pev->channel & 0xf];
+
+  c->track = pev->track;
+  switch (pev->data[0])
+  {
+  case 0xb0:  // control change
+    switch (pev->data[1])
+    {
+    case 0:   c->bank[0] = pev->data[2]; break;
+    case 32:  c->bank[1] = pev->data[2]; break;
+    case 7:   c->volume = pev->data[2];  break;
+    case 10:  c->pan = pev->data[2];     break;
+    case 64:  c->sustain = pev->data[2]; break;
+    case 121: // reset all controllers
+      c->sustain = 0;
+      c->bend = 0x2000;
+      break;
+    }
+    break;
+
+  case 0xc0:  // program change
+    c->program = pev->data[1];
+    break;
+
+  case 0xe0:  // pitch bend
+    c->bend = (pev->data[2] << 7) | pev->data[1];
+    break;
+  }
+}
+
+void MD_MIDIFile::chaseRestore(void)
+// Send the controller values set by the song, bank select before the program change
+{
+  midi_event ev;
+
+  for (uint8_t i = 0; i < BUF_SIZE(_chase); i++)
+  {
+    chase_state *c = &_chase[i];
+    // control number for each value, 0xff for the program change
+    const uint8_t ctl[] = { 0, 32, 0xff, 7, 10, 64 };
+    const uint8_t val[] = { c->bank[0], c->bank[1], c->program, c->volume, c->pan, c->sustain };
+
+    if (c->track == 0xff)   // no events for this channel
+      continue;
+
+    ev.track = c->track;
+    ev.channel = i;
+    for (uint8_t j = 0; j < BUF_SIZE(ctl); j++)
+    {
+      if (val[j] == 0xff)
+        continue;
+
+      if (ctl[j] == 0xff)
+      {
+        ev.size = 2;
+        ev.data[0] = 0xc0;
+        ev.data[1] = val[j];
+      }
+      else
+      {
+        ev.size = 3;
+        ev.data[0] = 0xb0;
+        ev.data[1] = ctl[j];
+        ev.data[2] = val[j];
+      }
+      dispatchMidi(&ev);
+    }
+
+    if (c->bend != 0xffff)
+    {
+      ev.size = 3;
+      ev.data[0] = 0xe0;
+      ev.data[1] = c->bend & 0x7f;
+      ev.data[2] = c->bend >> 7;
+      dispatchMidi(&ev);
+    }
+  }
+  flushOutput();
+}
+
+void MD_MIDIFile::releaseTempoMap(void)
+{
+  free(_tmap);
+  _tmap = nullptr;
+  _tmapCount = 0;
+  _tmapEndTick = 0;
+}
+
+int MD_MIDIFile::buildTempoMap(void)
+{
+  uint32_t  allocated = 0;
+  uint32_t  tick = 0, next;
+  uint64_t  time = 0;         // 32.32 fixed point microseconds
+  int16_t   delta = _tempoDelta;
+  uint32_t  usPerQN = _usPerQN;
+  uint8_t   timeSig[2] = { _timeSignature[0], _timeSignature[1] };
+  int       err = E_OK;
+
+  if (_devMode || _trackCount == 0)
+    return(E_NO_FILE);
+
+  releaseTempoMap();
+
+  // play the whole file silently, adding an entry for every change of tempo
+  _tempoDelta = 0;    // song time does not include the tempo adjustment
+  calcTickTime();
+  rewindTracks();
+  _seeking = true;
+
+  while (err == E_OK)
+  {
+    if (_tmapCount == 0 || _tmap[_tmapCount - 1].usPerQN != _usPerQN)
+    {
+      tempo_point *p;
+
+      if (_tmapCount > 0 && _tmap[_tmapCount - 1].tick == tick)
+        p = &_tmap[_tmapCount - 1];   // replaced at the same tick
+      else
+      {
+        if (_tmapCount == allocated)
+        {
+          tempo_point *tp = (tempo_point *)realloc(_tmap, (allocated + TMAP_ALLOC_STEP) * sizeof(tempo_point));
+
+          if (tp == nullptr)
+          {
+            err = E_NO_MEMORY;
+            break;
+          }
+          _tmap = tp;
+          allocated += TMAP_ALLOC_STEP;
+        }
+        p = &_tmap[_tmapCount++];
+      }
+
+      p->tick = tick;
+      p->time = (time + UINT32_MAX) >> 32;  // rounded up, as for tickToMicros()
+      p->usPerQN = _usPerQN;
+    }
+
+    if ((next = nextDueTick()) == UINT32_MAX)
+      break;
+
+    time += (uint64_t)(next - tick) * _tickTimeFP;
+    tick = next;
+    processDue(next);
+  }
+  _tmapEndTick = tick;    // the last event in the song, normally an end of track
+
+  // back to the start for playing
+  _seeking = false;
+  rewindTracks();
+  _tempoDelta = delta;
+  setTimeSignature(timeSig[0], timeSig[1]);
+  setMicrosecondPerQuarterNote(usPerQN);
+  _tickCount = 0;
+  _synchDone = false;
+
+  if (err != E_OK)
+  {
+    releaseTempoMap();
+    return(err);
+  }
+
+  DUMP("\nTempo map entries: ", _tmapCount);
+
+  return(E_OK);
+}
+
+uint32_t MD_MIDIFile::getDurationMicros(void)
+{
+  return(_tmapCount == 0 ? 0 : tickToMicros(_tmapEndTick));
+}
+
+uint32_t MD_MIDIFile::tickToMicros(uint32_t tick)
+{
+  int32_t lo = 0, hi = (int32_t)_tmapCount - 1, cp = 0;
+  uint32_t t = 0, us = _usPerQN;
+
+  if (_ticksPerQuarterNote == 0)
+    return(0);
+
+  // binary search for the last tempo change at or before the tick
+  while (lo <= hi)
+  {
+    int32_t mid = (lo + hi) / 2;
+
+    if (_tmap[mid].tick <= tick)
+    {
+      cp = mid;
+      lo = mid + 1;
+    }
+    else
+      hi = mid - 1;
+  }
+
+  if (_tmapCount != 0)
+  {
+    t = _tmap[cp].time;
+    us = _tmap[cp].usPerQN;
+    tick -= _tmap[cp].tick;
+  }
+
+  // rounded up so that microsToTick() gives back the same tick
+  return(t + (uint32_t)(((uint64_t)tick * us + _ticksPerQuarterNote - 1) / _ticksPerQuarterNote));
+}
+
+uint32_t MD_MIDIFile::microsToTick(uint32_t us)
+{
+  int32_t lo = 0, hi = (int32_t)_tmapCount - 1, cp = 0;
+  uint32_t tick = 0, q = _usPerQN;
+
+  // binary search for the last tempo change at or before the time
+  while (lo <= hi)
+  {
+    int32_t mid = (lo + hi) / 2;
+
+    if (_tmap[mid].time <= us)
+    {
+      cp = mid;
+      lo = mid + 1;
+    }
+    else
+      hi = mid - 1;
+  }
+
+  if (_tmapCount != 0)
+  {
+    tick = _tmap[cp].tick;
+    q = _tmap[cp].usPerQN;
+    us -= _tmap[cp].time;
+  }
+
+  if (q == 0)
+    return(tick);
+
+  return(tick + (uint32_t)(((uint64_t)us * _ticksPerQuarterNote) / q));
+}
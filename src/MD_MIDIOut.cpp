@@ -0,0 +1,122 @@
+/*
+  MD_MIDIOut.cpp - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "MD_MIDIFileSPIFF.h"
+
+/**
+ * \file
+ * \brief Main file for the MD_MIDIOut class implementation
+ */
+
+// Running status rules for the transmitter (MIDI 1.0 specification):
+// - channel messages (0x80-0xEF) set the running status,
+// - system common messages (0xF0-0xF7), which include SYSEX, cancel it,
+// - system real time messages (0xF8-0xFF) leave it unchanged.
+
+MD_MIDIOut::MD_MIDIOut(Print &out) : _out(out)
+{
+  _len = 0;
+  _status = 0;
+  _runningStatus = true;
+  _noteOffAsOn = false;
+  _written = _saved = 0;
+}
+
+void MD_MIDIOut::put(const uint8_t *data, uint16_t size)
+{
+  if (_len + size > MIDI_OUT_BUFFER_SIZE)
+  {
+    flush();
+    if (size >= MIDI_OUT_BUFFER_SIZE)   // no point copying it
+    {
+      _written += _out.write(data, size);
+      return;
+    }
+  }
+
+  memcpy(&_buf[_len], data, size);
+  _len += size;
+}
+
+void MD_MIDIOut::midi(const midi_event *pev)
+{
+  uint8_t msg[3];
+  uint8_t size = (pev->size > ARRAY_SIZE(msg)) ? ARRAY_SIZE(msg) : pev->size;
+
+  if (size == 0)
+    return;
+
+  memcpy(msg, pev->data, size);
+  if (msg[0] < 0xf0)            // channel message
+  {
+    if (_noteOffAsOn && msg[0] == 0x80 && size == 3)
+    {
+      msg[0] = 0x90;
+      msg[2] = 0;
+    }
+    msg[0] |= (pev->channel & 0xf);
+
+    if (_runningStatus && msg[0] == _status)
+    {
+      put(&msg[1], size - 1);
+      _saved++;
+      return;
+    }
+    _status = msg[0];
+  }
+  else if (msg[0] < 0xf8)       // system common
+    _status = 0;
+
+  put(msg, size);
+}
+
+void MD_MIDIOut::sysex(const sysex_event *pev)
+{
+  uint16_t size = (pev->size > ARRAY_SIZE(pev->data)) ? ARRAY_SIZE(pev->data) : pev->size;
+
+  _status = 0;
+  put(pev->data, size);
+
+  // the end of the message was cut off
+  if (size < pev->size && pev->data[size - 1] != 0xf7)
+  {
+    uint8_t eox = 0xf7;
+
+    put(&eox, 1);
+  }
+}
+
+void MD_MIDIOut::sysexChunk(const sysex_chunk *pch)
+{
+  _status = 0;
+  if (pch->first && pch->status == 0xf0)
+    put(&pch->status, 1);
+  put(pch->data, pch->size);
+}
+
+void MD_MIDIOut::flush(void)
+{
+  if (_len == 0)
+    return;
+
+  _written += _out.write(_buf, _len);
+  _len = 0;
+}
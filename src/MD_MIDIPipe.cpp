@@ -0,0 +1,239 @@
+/*
+  MD_MIDIPipe.cpp - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <stdlib.h>
+#include "MD_MIDIFileSPIFF.h"
+
+/**
+ * \file
+ * \brief Main file for the pipeline playback engine
+ */
+
+// The queue is a single producer (decoder task), single consumer (playback) ring.
+// _pipeHead and _pipeTail are free running counts of the events added and taken,
+// so the slot is the count modulo MIDI_PIPE_SIZE and the events in the queue are
+// always head - tail. Only the decoder writes _pipeHead and only playback writes
+// _pipeTail, and the release/acquire pairs make the event data visible before the
+// count that covers it.
+
+// Time (milliseconds) the decoder sleeps when the queue is full or it is waiting
+// for events to come inside the MIDI_PIPE_AHEAD window.
+#define PIPE_IDLE     1
+
+// Decoder task settings (ESP32)
+#define PIPE_STACK    4096  // stack size in bytes
+#define PIPE_PRIORITY 1     // same as the Arduino loop() task
+
+#define PIPE_MASK     (MIDI_PIPE_SIZE - 1)  // queue slot from an event count
+
+#if MIDI_TIMER_ESP32 || MIDI_TIMER_POSIX
+static_assert((MIDI_PIPE_SIZE & PIPE_MASK) == 0 && MIDI_PIPE_SIZE <= 32768, "MIDI_PIPE_SIZE must be a power of 2");
+
+bool MD_MIDIFile::pipeDecode(void)
+// Read the next events into the queue, returns false when the decoder should stop
+{
+  uint16_t head, space, n = 0;
+
+  if (!_pipeRunning)
+    return(false);
+
+  if (_ctlPending.load(std::memory_order_relaxed) != 0)
+    applyTransport(true);
+
+  // free slots, only up to the end of the ring so the window is contiguous
+  head = _pipeHead.load(std::memory_order_relaxed);
+  space = MIDI_PIPE_SIZE - (uint16_t)(head - _pipeTail.load(std::memory_order_acquire));
+  if (space > MIDI_PIPE_SIZE - (head & PIPE_MASK))
+    space = MIDI_PIPE_SIZE - (head & PIPE_MASK);
+
+  if (space != 0)
+  {
+    n = fillWindow(micros() - _pipeShift + (MIDI_PIPE_AHEAD * 1000UL), &_pipe[head & PIPE_MASK], space);
+    if (n != 0)
+    {
+      _pipeHead.store(head + n, std::memory_order_release);
+      return(true);
+    }
+
+    if (nextDueTick() == UINT32_MAX)    // end of the file
+    {
+      uint64_t t = _windowTime;
+
+      if (!_looping)
+      {
+        _pipeDone = true;
+        return(false);
+      }
+
+      // carry on from the end of the song without resetting the clock
+      restart();
+      synchTracks();
+      _synchDone = true;
+      _windowTime = t;
+      return(true);
+    }
+  }
+
+  delay(PIPE_IDLE);
+  return(true);
+}
+
+bool MD_MIDIFile::pipeDispatch(void)
+// Playback side, pass the events that are due to the callbacks
+{
+  uint16_t tail = _pipeTail.load(std::memory_order_relaxed);
+  uint16_t head = _pipeHead.load(std::memory_order_acquire);
+  uint32_t now = micros() - _pipeShift;
+  bool bDone = false;
+
+  while (tail != head)
+  {
+    timed_event *te = &_pipe[tail & PIPE_MASK];
+
+    if ((int32_t)(now - te->time) < 0)   // not due yet
+      break;
+
+    if (te->type == TIMED_MIDI)
+      sendMidi(&te->midi);
+    else
+      sendSysex(&te->sysex);
+
+    // give the slot back straight away
+    _pipeTail.store(++tail, std::memory_order_release);
+    bDone = true;
+  }
+  if (bDone)
+    flushOutput();
+
+  return(bDone);
+}
+
+uint32_t MD_MIDIFile::pipeWait(void)
+// Microseconds until the next event in the queue is due
+{
+  uint16_t tail = _pipeTail.load(std::memory_order_relaxed);
+  int32_t wait;
+
+  if (tail == _pipeHead.load(std::memory_order_acquire))   // the decoder is behind or finished
+    return(_pipeDone ? UINT32_MAX : PIPE_IDLE * 1000UL);
+
+  wait = _pipe[tail & PIPE_MASK].time - (micros() - _pipeShift);
+
+  return(wait <= 0 ? 0 : wait);
+}
+
+#if MIDI_TIMER_ESP32
+void mdPipeTask(void *arg)
+// Decoder task, pinned to MIDI_PIPE_CORE
+{
+  MD_MIDIFile *mf = (MD_MIDIFile *)arg;
+
+  while (mf->pipeDecode())
+    ;   // keep the queue full
+
+  mf->_pipeTaskDone = true;
+  vTaskDelete(nullptr);
+}
+#else
+void *mdPipeThread(void *arg)
+// Decoder thread
+{
+  MD_MIDIFile *mf = (MD_MIDIFile *)arg;
+
+  while (mf->pipeDecode())
+    ;   // keep the queue full
+
+  return(nullptr);
+}
+#endif
+
+bool MD_MIDIFile::startPipeline(void)
+{
+  bool bOk;
+
+  stopPipeline();
+  if (_devMode || _trackCount == 0)
+    return(false);
+
+  if ((_pipe = (timed_event *)malloc(MIDI_PIPE_SIZE * sizeof(timed_event))) == nullptr)
+    return(false);
+
+  // sync start all the tracks if we need to
+  if (!_synchDone)
+  {
+    synchTracks();
+    _synchDone = true;
+  }
+
+  // the clock starts now, from the current song position
+  _windowTick = _tickCount;
+  _windowTime = (uint64_t)micros() << 32;
+  _pipeHead = _pipeTail = 0;
+  _pipeShift = 0;
+  _pauseTime = micros();    // a pause in effect counts from now
+  _pipeDone = false;
+  _pipeRunning = true;
+
+#if MIDI_TIMER_ESP32
+  _pipeTaskDone = false;
+  bOk = (xTaskCreatePinnedToCore(mdPipeTask, "MD_MIDIPipe", PIPE_STACK, this, PIPE_PRIORITY, nullptr, MIDI_PIPE_CORE) == pdPASS);
+#else
+  bOk = (pthread_create(&_pipeThread, nullptr, mdPipeThread, this) == 0);
+#endif
+
+  if (!bOk)
+  {
+    _pipeRunning = false;
+    free(_pipe);
+    _pipe = nullptr;
+  }
+
+  return(bOk);
+}
+
+void MD_MIDIFile::stopPipeline(void)
+{
+  if (_pipe == nullptr)
+    return;
+
+  _pipeRunning = false;
+#if MIDI_TIMER_ESP32
+  while (!_pipeTaskDone)
+    delay(1);
+#else
+  pthread_join(_pipeThread, nullptr);
+#endif
+
+  free(_pipe);
+  _pipe = nullptr;
+}
+
+#else
+bool MD_MIDIFile::startPipeline(void)
+// Not available on this platform
+{
+  return(false);
+}
+
+void MD_MIDIFile::stopPipeline(void)
+{
+}
+#endif
@@ -0,0 +1,199 @@
+/*
+  MD_MIDISource.h - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _MDMIDISOURCE_H
+#define _MDMIDISOURCE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <SPIFFS.h>
+
+#if defined(ESP32) || !defined(ARDUINO)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#define MIDI_SOURCE_POSIX 1   ///< POSIX file descriptors are available on this platform
+#else
+#define MIDI_SOURCE_POSIX 0   ///< POSIX file descriptors are available on this platform
+#endif
+
+/**
+ * \file
+ * \brief Header file for the SMF byte source definitions
+ *
+ * A byte source supplies the raw SMF data to the library. The sources are
+ * plain classes with no virtual methods that all implement the same set of
+ * methods, so they can be used as a compile time policy (template parameter
+ * or typedef) and the byte decoders inline directly against them:
+ *
+ * - operator bool() - true if the source is open.
+ * - void close(void) - close the source.
+ * - int read(void) - read the next byte, -1 if there is no more data.
+ * - size_t read(uint8_t *buf, size_t len) - read a block of bytes, returns the number read.
+ * - bool seek(uint32_t pos) - move to the absolute position pos.
+ * - uint32_t position(void) - the current absolute position.
+ * - uint32_t size(void) - the total size of the data.
+ *
+ * File sources are opened with open(const char *name) and memory sources with
+ * open(const uint8_t *data, uint32_t size).
+ *
+ * File sources also implement the methods needed to write compiled event files:
+ *
+ * - bool create(const char *name) - create (or truncate) the named file for writing.
+ * - size_t write(const uint8_t *buf, size_t len) - write a block of bytes, returns the number written.
+ * - uint32_t mtime(void) - the last modification time of the open file.
+ */
+
+/**
+ * Byte source for a file in the SPIFFS file system.
+ */
+class MD_MFSourceSPIFFS
+{
+public:
+  /**
+   * Open the named file for reading
+   *
+   * \param name the file name.
+   * \return true if the file was opened.
+   */
+  bool open(const char *name) { _f = SPIFFS.open(name, "r"); return((bool)_f); }
+
+  /**
+   * Create the named file for writing
+   *
+   * \param name the file name.
+   * \return true if the file was created.
+   */
+  bool create(const char *name) { _f = SPIFFS.open(name, "w"); return((bool)_f); }
+
+  void close(void) { _f.close(); }          ///< close the file
+  operator bool() { return((bool)_f); }     ///< true if the file is open
+  int read(void) { return(_f.read()); }     ///< read the next byte, -1 at end of file
+  size_t read(uint8_t *buf, size_t len) { return(_f.read(buf, len)); } ///< read a block of bytes
+  bool seek(uint32_t pos) { return(_f.seek(pos, SeekSet)); }           ///< move to the absolute position
+  uint32_t position(void) { return(_f.position()); }                  ///< current absolute position
+  uint32_t size(void) { return(_f.size()); }                          ///< size of the file in bytes
+  size_t write(const uint8_t *buf, size_t len) { return(_f.write(buf, len)); } ///< write a block of bytes
+  uint32_t mtime(void) { return(_f.getLastWrite()); }                 ///< last modification time
+
+private:
+  File  _f;     ///< the SPIFFS file
+};
+
+/**
+ * Byte source for SMF data held in a memory buffer.
+ */
+class MD_MFSourceMem
+{
+public:
+  /**
+   * Use the memory buffer as the data
+   *
+   * The buffer is located in user code and must persist while it is being used.
+   *
+   * \param data pointer to the SMF data.
+   * \param size the size of the data in bytes.
+   * \return true if the buffer is valid.
+   */
+  bool open(const uint8_t *data, uint32_t size) { _data = data; _size = size; _pos = 0; return(_data != nullptr); }
+
+  void close(void) { _data = nullptr; _size = _pos = 0; }  ///< stop using the buffer
+  operator bool() { return(_data != nullptr); }           ///< true if the buffer is set
+  int read(void) { return(_pos < _size ? _data[_pos++] : -1); } ///< read the next byte, -1 at end of data
+
+  /** read a block of bytes, returns the number read */
+  size_t read(uint8_t *buf, size_t len)
+  {
+    if (len > _size - _pos) len = _size - _pos;
+    memcpy(buf, _data + _pos, len);
+    _pos += len;
+    return(len);
+  }
+
+  bool seek(uint32_t pos) { if (pos > _size) return(false); _pos = pos; return(true); } ///< move to the absolute position
+  uint32_t position(void) { return(_pos); }  ///< current absolute position
+  uint32_t size(void) { return(_size); }     ///< size of the data in bytes
+
+private:
+  const uint8_t *_data = nullptr; ///< the SMF data
+  uint32_t  _size = 0;            ///< size of the data
+  uint32_t  _pos = 0;             ///< current read position
+};
+
+#if MIDI_SOURCE_POSIX
+/**
+ * Byte source for a file accessed through a POSIX file descriptor.
+ *
+ * This allows the library to run on a host (eg, Linux) and can also be used on
+ * the ESP32 through the ESP-IDF virtual file system.
+ */
+class MD_MFSourcePosix
+{
+public:
+  /**
+   * Open the named file for reading
+   *
+   * \param name the file name.
+   * \return true if the file was opened.
+   */
+  bool open(const char *name) { close(); _fd = ::open(name, O_RDONLY); return(_fd >= 0); }
+
+  /**
+   * Create the named file for writing
+   *
+   * \param name the file name.
+   * \return true if the file was created.
+   */
+  bool create(const char *name) { close(); _fd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644); return(_fd >= 0); }
+
+  void close(void) { if (_fd >= 0) ::close(_fd); _fd = -1; }  ///< close the file
+  operator bool() { return(_fd >= 0); }                      ///< true if the file is open
+  int read(void) { uint8_t c; return(::read(_fd, &c, 1) == 1 ? c : -1); } ///< read the next byte, -1 at end of file
+
+  /** read a block of bytes, returns the number read */
+  size_t read(uint8_t *buf, size_t len) { ssize_t n = ::read(_fd, buf, len); return(n < 0 ? 0 : n); }
+
+  bool seek(uint32_t pos) { return(lseek(_fd, pos, SEEK_SET) == (off_t)pos); } ///< move to the absolute position
+  uint32_t position(void) { return(lseek(_fd, 0, SEEK_CUR)); }              ///< current absolute position
+
+  /** size of the file in bytes */
+  uint32_t size(void)
+  {
+    off_t cur = lseek(_fd, 0, SEEK_CUR);
+    off_t end = lseek(_fd, 0, SEEK_END);
+
+    lseek(_fd, cur, SEEK_SET);
+    return(end < 0 ? 0 : end);
+  }
+
+  /** write a block of bytes, returns the number written */
+  size_t write(const uint8_t *buf, size_t len) { ssize_t n = ::write(_fd, buf, len); return(n < 0 ? 0 : n); }
+
+  /** last modification time */
+  uint32_t mtime(void) { struct stat st; return(fstat(_fd, &st) == 0 ? st.st_mtime : 0); }
+
+private:
+  int _fd = -1;   ///< the file descriptor
+};
+#endif // MIDI_SOURCE_POSIX
+
+#endif
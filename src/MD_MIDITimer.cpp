@@ -0,0 +1,209 @@
+/*
+  MD_MIDITimer.cpp - An Arduino library for processing Standard MIDI Files (SMF).
+  Copyright (C) 2012 Marco Colli
+  All rights reserved.
+
+  See MD_MIDIFile.h for complete comments
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <string.h>
+#include "MD_MIDIFileSPIFF.h"
+
+#if MIDI_TIMER_POSIX
+#include <time.h>
+#include <errno.h>
+#endif
+
+/**
+ * \file
+ * \brief Main file for the timer driven playback engine
+ */
+
+// Longest time (microseconds) between timer dispatches. This is the time
+// between checks when paused and limits how long stopTimer() waits.
+#define TIMER_IDLE  10000
+
+uint32_t MD_MIDIFile::timerDispatch(void)
+// Process the events due and work out when to run again
+{
+  uint32_t now = micros();
+  uint32_t wait;
+  bool sent;
+
+  _budgetUsed = 0;
+  sent = getNextEvent();
+  if (_pipe == nullptr)   // a tick can pass with no events due
+    sent = sent && (_budgetUsed != 0);
+
+  if (sent && _timerDueSet)   // lateness against the time the event was due
+  {
+    uint32_t late = ((int32_t)(now - _timerDue) > 0) ? now - _timerDue : 0;
+
+    _timerStats.dispatches++;
+    _timerStats.lastLate = late;
+    _timerStats.totalLate += late;
+    if (late > _timerStats.maxLate) _timerStats.maxLate = late;
+
+    if (_lateHandler != nullptr)
+      (_lateHandler)(late);
+  }
+
+  if (isEOF())    // restarts the file if looping
+    return(UINT32_MAX);
+
+  wait = getMicrosToNextEvent();
+  _timerDueSet = (wait != UINT32_MAX);    // not paused and there is an event
+  _timerDue = micros() + wait;
+  if (wait > TIMER_IDLE)    // paused or a long wait, check again later
+    wait = TIMER_IDLE;
+
+  return(wait);
+}
+
+#if MIDI_TIMER_ESP32
+void mdTimerCallback(void *arg)
+// esp_timer callback, runs in the esp_timer task
+{
+  MD_MIDIFile *mf = (MD_MIDIFile *)arg;
+
+  mf->_timerBusy = true;
+  if (mf->_timerRunning)
+  {
+    uint32_t wait = mf->timerDispatch();
+
+    if (wait == UINT32_MAX)
+      mf->_timerRunning = false;
+    else if (mf->_timerRunning)
+      esp_timer_start_once(mf->_timer, (wait == 0) ? 1 : wait);
+  }
+  mf->_timerBusy = false;
+}
+
+bool MD_MIDIFile::startTimer(void)
+{
+  esp_timer_create_args_t args;
+
+  stopTimer();
+  memset(&_timerStats, 0, sizeof(_timerStats));
+
+  memset(&args, 0, sizeof(args));
+  args.callback = &mdTimerCallback;
+  args.arg = this;
+  args.dispatch_method = ESP_TIMER_TASK;
+  args.name = "MD_MIDIFile";
+  if (esp_timer_create(&args, &_timer) != ESP_OK)
+  {
+    _timer = nullptr;
+    return(false);
+  }
+
+  _timerBusy = false;
+  _timerRunning = true;
+  _timerDue = micros();
+  _timerDueSet = false;
+  if (esp_timer_start_once(_timer, 1) != ESP_OK)
+  {
+    stopTimer();
+    return(false);
+  }
+
+  return(true);
+}
+
+void MD_MIDIFile::stopTimer(void)
+{
+  _timerRunning = false;
+  if (_timer == nullptr)
+    return;
+
+  while (_timerBusy)    // let the callback finish, it may rearm the timer
+    delay(1);
+  esp_timer_stop(_timer);
+  esp_timer_delete(_timer);
+  _timer = nullptr;
+}
+
+#elif MIDI_TIMER_POSIX
+void *mdTimerThread(void *arg)
+// Playback thread, sleeps until the next event is due
+{
+  MD_MIDIFile *mf = (MD_MIDIFile *)arg;
+
+  while (mf->_timerRunning)
+  {
+    struct timespec t;
+    uint32_t wait = mf->timerDispatch();
+
+    if (wait == UINT32_MAX)
+    {
+      mf->_timerRunning = false;
+      break;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    t.tv_nsec += (long)wait * 1000;
+    while (t.tv_nsec >= 1000000000L)
+    {
+      t.tv_nsec -= 1000000000L;
+      t.tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr) == EINTR)
+      ;   // sleep again for the rest of the time
+  }
+
+  return(nullptr);
+}
+
+bool MD_MIDIFile::startTimer(void)
+{
+  stopTimer();
+  memset(&_timerStats, 0, sizeof(_timerStats));
+
+  _timerRunning = true;
+  _timerDue = micros();
+  _timerDueSet = false;
+  if (pthread_create(&_timerThread, nullptr, mdTimerThread, this) != 0)
+  {
+    _timerRunning = false;
+    return(false);
+  }
+  _timerJoin = true;
+
+  return(true);
+}
+
+void MD_MIDIFile::stopTimer(void)
+{
+  _timerRunning = false;
+  if (_timerJoin)
+  {
+    pthread_join(_timerThread, nullptr);
+    _timerJoin = false;
+  }
+}
+
+#else
+bool MD_MIDIFile::startTimer(void)
+// Not available on this platform
+{
+  return(false);
+}
+
+void MD_MIDIFile::stopTimer(void)
+{
+  _timerRunning = false;
+}
+#endif
@@ -30,16 +30,49 @@
  * \brief Main file for the MFTrack class implementation
  */
 
+// Scheduling state of a track that is not attached to an MD_MIDIFile
+static uint32_t dueUnused;
+
+// Class of each status byte used by parseEvent(). MIDI channel messages 
+// also have the number of data bytes that follow the status byte.
+#define EV_UNKNOWN  0x00  // not allowed in an SMF track
+#define EV_LENGTH   0x03  // mask for the number of data bytes
+#define EV_STATUS   0x04  // MIDI status byte, clear for running status data
+#define EV_MIDI     0x08  // MIDI channel message
+#define EV_SYSEX    0x10  // SYSEX or escape (0xF0, 0xF7)
+#define EV_META     0x20  // META event (0xFF)
+
+#define EV_ROW(x)   x, x, x, x, x, x, x, x, x, x, x, x, x, x, x, x  // 16 status bytes
+
+static constexpr uint8_t statusTable[256] =
+{
+  EV_ROW(EV_MIDI), EV_ROW(EV_MIDI), EV_ROW(EV_MIDI), EV_ROW(EV_MIDI), // 0x00-0x3F running status
+  EV_ROW(EV_MIDI), EV_ROW(EV_MIDI), EV_ROW(EV_MIDI), EV_ROW(EV_MIDI), // 0x40-0x7F running status
+  EV_ROW(EV_MIDI | EV_STATUS | 2),  // 0x80 note off
+  EV_ROW(EV_MIDI | EV_STATUS | 2),  // 0x90 note on
+  EV_ROW(EV_MIDI | EV_STATUS | 2),  // 0xA0 polyphonic pressure
+  EV_ROW(EV_MIDI | EV_STATUS | 2),  // 0xB0 control change
+  EV_ROW(EV_MIDI | EV_STATUS | 1),  // 0xC0 program change
+  EV_ROW(EV_MIDI | EV_STATUS | 1),  // 0xD0 channel pressure
+  EV_ROW(EV_MIDI | EV_STATUS | 2),  // 0xE0 pitch bend
+  EV_SYSEX, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_SYSEX,  // 0xF0-0xF7
+  EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_UNKNOWN, EV_META, // 0xF8-0xFF
+};
+
 void MD_MFTrack::reset(void)
 {
   _length = 0;        // length of track in bytes
   _startOffset = 0;   // start of the track in bytes from start of file
+  _buf = _bufData;    // read-ahead buffer is empty
+  _bufOffset = 0;
+  _bufLen = 0;
   restart();
   _trackId = 255;
 }
 
 MD_MFTrack::MD_MFTrack(void)
 {
+  _dueSlot = &dueUnused;
   reset();
 }
 
@@ -65,60 +98,212 @@ bool MD_MFTrack::getEndOfTrack(void)
 }
 
 void MD_MFTrack::syncTime(void)
+// Rebase the track time to the start of playback (tick 0)
 {
-  _elapsedTicks = 0;
+  if (_dueValid) _dueTick -= _eventTick;
+  _eventTick = 0;
+  publishDue();
 }
 
 void MD_MFTrack::restart(void)
-// Start playing the track from the beginning again
+// Start playing the track from the beginning again.
+// The buffer contents remain valid as the track data does not change.
 {
   _currOffset = 0;
   _endOfTrack = false;
-  _elapsedTicks = 0;
+  _eventTick = 0;
+  _dueTick = 0;
+  _dueValid = false;
+  publishDue();
+
+  // no running status at the start of the track
+  memset(_mev.data, 0, sizeof(_mev.data));
+  _mev.size = 0;
+  _mev.channel = 0;
 }
 
-bool MD_MFTrack::getNextEvent(MD_MIDIFile *mf, uint16_t tickCount)
-// track_event = <time:v> + [<midi_event> | <meta_event> | <sysex_event>]
+void MD_MFTrack::getCheckpoint(MD_MIDIFile *mf, track_checkpoint *cp)
+// Save the state needed to continue playing from the current position
 {
-  uint32_t deltaT;
+  cp->dueTick = getDueTick(mf);   // decodes the next DeltaT if needed
+  cp->offset = _currOffset;
+  cp->status = _mev.data[0] | _mev.channel;
+  cp->eot = _endOfTrack;
+}
 
-  // is there anything to process?
-  if (_endOfTrack)
+void MD_MFTrack::setCheckpoint(const track_checkpoint *cp)
+// Continue playing from a saved state. The buffer is refilled as needed.
+{
+  _currOffset = cp->offset;
+  _endOfTrack = cp->eot;
+  _dueTick = _eventTick = cp->dueTick;
+  _dueValid = !cp->eot;
+  publishDue();
+
+  // recreate the running status
+  _mev.data[0] = cp->status & 0xf0;
+  _mev.channel = cp->status & 0xf;
+  _mev.size = (_mev.data[0] == 0xc0 || _mev.data[0] == 0xd0) ? 2 : 3;
+}
+
+bool MD_MFTrack::fillBuffer(MD_MIDIFile *mf)
+// Read the next block of track data into the buffer
+{
+  uint32_t n;
+
+  // Nothing to read, leave the buffer as it is. For a track loaded in 
+  // memory this is the only way to get here.
+  if (_currOffset >= _length)
+    return(false);
+
+  _bufOffset = _currOffset;
+  n = min((uint32_t)(_length - _currOffset), (uint32_t)MIDI_TRACK_BUFFER_SIZE);
+  mf->_fd.seek(_startOffset + _currOffset);
+  _bufLen = mf->_fd.read(_bufData, n);
+
+  return(_bufLen != 0);
+}
+
+bool MD_MFTrack::prefetch(MD_MIDIFile *mf, uint16_t low)
+// Top up the buffer, keeping the bytes not decoded yet
+{
+  uint32_t idx = _currOffset - _bufOffset;
+  uint32_t keep, end, n;
+
+  if (_buf != _bufData || _endOfTrack)    // played from memory or nothing more to play
     return(false);
 
-  // move the file pointer to where we left off
-  mf->_fd.seek(_startOffset+_currOffset, SeekSet);
+  if (_currOffset < _bufOffset || idx >= _bufLen)   // empty, or moved by a seek
+    return(fillBuffer(mf));
+
+  keep = _bufLen - idx;
+  end = _bufOffset + _bufLen;
+  if (keep >= low || end >= _length)
+    return(false);
+
+  memmove(_bufData, _bufData + idx, keep);
+  n = min((uint32_t)(_length - end), (uint32_t)(MIDI_TRACK_BUFFER_SIZE - keep));
+  mf->_fd.seek(_startOffset + end);
+  _bufOffset = _currOffset;
+  _bufLen = keep + mf->_fd.read(_bufData + keep, n);
+
+  return(true);
+}
+
+uint8_t MD_MFTrack::getByte(MD_MIDIFile *mf)
+// Next byte from the buffer, refilling it if needed
+{
+  uint32_t idx = _currOffset - _bufOffset;
+
+  if (idx >= _bufLen)    // also catches _currOffset before the buffer start
+  {
+    if (!fillBuffer(mf))
+    {
+      // ran out of track data in the middle of an event
+      _endOfTrack = true;
+      return(0);
+    }
+    idx = 0;
+  }
+
+  _currOffset++;
+  return(_buf[idx]);
+}
+
+uint16_t MD_MFTrack::getBlock(MD_MIDIFile *mf, const uint8_t **p, uint32_t len)
+// Point to the next bytes in the buffer, refilling it if needed
+{
+  uint32_t idx = _currOffset - _bufOffset;
+
+  if (len == 0)
+    return(0);
+
+  if (idx >= _bufLen)
+  {
+    if (!fillBuffer(mf))
+    {
+      _endOfTrack = true;
+      return(0);
+    }
+    idx = 0;
+  }
+
+  len = min(len, _bufLen - idx);
+  if (len > UINT16_MAX) len = UINT16_MAX;
+  *p = &_buf[idx];
+  _currOffset += len;
+
+  return(len);
+}
+
+uint32_t MD_MFTrack::getVarLen(MD_MIDIFile *mf)
+// read variable length parameter from the track buffer
+{
+  uint32_t  value = 0;
+  uint8_t   c;
+
+  do
+  {
+    c = getByte(mf);
+    value = (value << 7) + (c & 0x7f);
+  } while (c & 0x80);
 
-  // Work out new total elapsed ticks - include the overshoot from
-  // last event.
-  _elapsedTicks += tickCount;
+  return(value);
+}
+
+uint32_t MD_MFTrack::getMultiByte(MD_MIDIFile *mf, uint8_t nLen)
+// read fixed length parameter from the track buffer
+{
+  uint32_t  value = 0L;
 
-  // Get the DeltaT from the file in order to see if enough ticks have
-  // passed for the event to be active.
-  deltaT = readVarLen(&mf->_fd);
+  for (uint8_t i = 0; i < nLen; i++)
+    value = (value << 8) + getByte(mf);
 
-  // If not enough ticks, just return without saving the file pointer and 
-  // we will go back to the same spot next time.
-  if (_elapsedTicks < deltaT)
+  return(value);
+}
+
+uint32_t MD_MFTrack::getDueTick(MD_MIDIFile *mf)
+// Absolute tick for the next event, decoding the DeltaT only the first time
+{
+  if (!_dueValid && !_endOfTrack)
+  {
+    // The DeltaT is relative to the last event processed. Working from the 
+    // tick the last event was due (not when it was actually processed) avoids 
+    // accumulation of errors when events are processed late.
+    _dueTick = _eventTick + getVarLen(mf);
+    _dueValid = true;
+    publishDue();
+  }
+
+  return(_dueTick);
+}
+
+bool MD_MFTrack::getNextEvent(MD_MIDIFile *mf)
+// track_event = <time:v> + [<midi_event> | <meta_event> | <sysex_event>]
+{
+  // is there anything to process?
+  if (_endOfTrack)
     return(false);
 
-  // Adjust the total elapsed time to the error against actual DeltaT to avoid 
-  // accumulation of errors, as we only check for _elapsedTicks being >= ticks,
-  // giving positive biased errors every time.
-  _elapsedTicks -= deltaT;
+  // If not enough ticks have passed for the event to be active, just return.
+  // Once decoded the due tick is kept, so this needs no file or buffer access.
+  if (getDueTick(mf) > mf->_tickCount)
+    return(false);
 
-  DUMP("\ndT: ", deltaT);
-  DUMP(" + ", _elapsedTicks);
+  DUMP("\ndT: ", _dueTick - _eventTick);
+  DUMP(" + ", mf->_tickCount - _dueTick);
   DUMPS("\t");
 
-  parseEvent(mf);
+  // the next DeltaT is relative to this event
+  _eventTick = _dueTick;
+  _dueValid = false;
 
-  // remember the offset for next time
-  _currOffset = mf->_fd.position() - _startOffset;
+  parseEvent(mf);
 
   // catch end of track when there is no META event  
   _endOfTrack = _endOfTrack || (_currOffset >= _length);
   if (_endOfTrack) DUMPS(" - OUT OF TRACK");
+  publishDue();
 
   return(true);
 }
@@ -127,323 +312,165 @@ void MD_MFTrack::parseEvent(MD_MIDIFile *mf)
 // process the event from the physical file
 {
   uint8_t eType;
-  uint32_t mLen;
+  uint8_t eClass;
 
   // now we have to process this event
-  eType = mf->_fd.read();
+  eType = getByte(mf);
+  eClass = statusTable[eType];
 
-  switch (eType)
-  {
 // ---------------------------- MIDI
-    // midi_event = any MIDI channel message, including running status
-    // Midi events (status bytes 0x8n - 0xEn) The standard Channel MIDI messages, where 'n' is the MIDI channel (0 - 15).
-    // This status byte will be followed by 1 or 2 data bytes, as is usual for the particular MIDI message. 
-    // Any valid Channel MIDI message can be included in a MIDI file.
-  case 0x80 ... 0xBf: // MIDI message with 2 parameters
-  case 0xe0 ... 0xef:
-    _mev.size = 3;
-    _mev.data[0] = eType;
-    _mev.channel = _mev.data[0] & 0xf;  // mask off the channel
-    _mev.data[0] = _mev.data[0] & 0xf0; // just the command byte
-    _mev.data[1] = mf->_fd.read();
-    _mev.data[2] = mf->_fd.read();
-    DUMP("[MID2] Ch: ", _mev.channel);
-    DUMPX(" Data: ", _mev.data[0]);
-    DUMPX(" ", _mev.data[1]);
-    DUMPX(" ", _mev.data[2]);
-#if !DUMP_DATA
-    if (mf->_midiHandler != nullptr)
-      (mf->_midiHandler)(&_mev);
-#endif // !DUMP_DATA
-  break;
-
-  case 0xc0 ... 0xdf: // MIDI message with 1 parameter
-    _mev.size = 2;
-    _mev.data[0] = eType;
-    _mev.channel = _mev.data[0] & 0xf;  // mask off the channel
-    _mev.data[0] = _mev.data[0] & 0xf0; // just the command byte
-    _mev.data[1] = mf->_fd.read();
-    DUMP("[MID1] Ch: ", _mev.channel);
-    DUMPX(" Data: ", _mev.data[0]);
-    DUMPX(" ", _mev.data[1]);
-
-#if !DUMP_DATA
-    if (mf->_midiHandler != nullptr)
-      (mf->_midiHandler)(&_mev);
-#endif
-  break;
-
-  case 0x00 ... 0x7f: // MIDI run on message
+  // midi_event = any MIDI channel message, including running status
+  // Midi events (status bytes 0x8n - 0xEn) The standard Channel MIDI messages, where 'n' is the MIDI channel (0 - 15).
+  // This status byte will be followed by 1 or 2 data bytes, as is usual for the particular MIDI message. 
+  // Any valid Channel MIDI message can be included in a MIDI file.
+  //
+  // If the first (status) byte is less than 128 (0x80), this implies that MIDI 
+  // running status is in effect, and that this byte is actually the first data byte 
+  // (the status carrying over from the previous MIDI event). 
+  // This can only be the case if the immediately previous event was also a MIDI event, 
+  // ie SysEx and Meta events clear running status. This means that the _mev structure 
+  // still holds the channel, command and size of the previous message.
+  // A data byte with no earlier status is handled as an unknown event below.
+  if ((eClass & EV_MIDI) && ((eClass & EV_STATUS) || _mev.size != 0))
   {
-    // If the first (status) byte is less than 128 (0x80), this implies that MIDI 
-    // running status is in effect, and that this byte is actually the first data byte 
-    // (the status carrying over from the previous MIDI event). 
-    // This can only be the case if the immediately previous event was also a MIDI event, 
-    // ie SysEx and Meta events clear running status. This means that the _mev structure 
-    // should contain the info from the previous message in the structure's channel member 
-    // and data[0] (for the MIDI command). 
-    // Hence start saving the data at byte data[1] with the byte we have just read (eType) 
-    // and use the size member to determine how large the message is (ie, same as before).
-    _mev.data[1] = eType;
-    for (uint8_t i = 2; i < _mev.size; i++)
+    if (eClass & EV_STATUS)
     {
-      _mev.data[i] = mf->_fd.read();  // next byte
-    } 
+      _mev.size = (eClass & EV_LENGTH) + 1;
+      _mev.channel = eType & 0xf;     // mask off the channel
+      _mev.data[0] = eType & 0xf0;    // just the command byte
+      eType = getByte(mf);
+    }
+    _mev.data[1] = eType;
+    if (_mev.size > 2)
+      _mev.data[2] = getByte(mf);
 
-    DUMP("[MID+] Ch: ", _mev.channel);
+    DUMP("[MIDI] Ch: ", _mev.channel);
     DUMPS(" Data:");
     for (uint8_t i = 0; i<_mev.size; i++)
     {
       DUMPX(" ", _mev.data[i]);
     }
-
 #if !DUMP_DATA
-    if (mf->_midiHandler != nullptr)
-      (mf->_midiHandler)(&_mev);
+    mf->dispatchMidi(&_mev);
 #endif
+    return;
   }
-  break;
 
+  switch (eClass)
+  {
 // ---------------------------- SYSEX
-  case 0xf0:  // sysex_event = 0xF0 + <len:1> + <data_bytes> + 0xF7 
-  case 0xf7:  // sysex_event = 0xF7 + <len:1> + <data_bytes> + 0xF7 
+  case EV_SYSEX:  // sysex_event = 0xF0 (or 0xF7) + <len:v> + <data_bytes> + 0xF7 
+    parseSysex(mf, eType);
+    break;
+
+// ---------------------------- META
+  case EV_META:   // meta_event = 0xFF + <meta_type:1> + <length:v> + <event_data_bytes>
+    parseMeta(mf);
+    break;
+  
+// ---------------------------- UNKNOWN
+  default:
+    // stop playing this track as we cannot identify the eType
+    _endOfTrack = true;
+    DUMPX("[UKNOWN 0x", eType);
+    DUMPS("] Track aborted");
+    break;
+  }
+}
+
+// SYSEX and META events are rare, so these are kept out of line
+// to keep the MIDI message path in parseEvent() small.
+__attribute__((noinline)) void MD_MFTrack::parseSysex(MD_MIDIFile *mf, uint8_t eType)
+// process a SYSEX event, the status byte has been read
+{
+  uint32_t mLen;
+  sysex_event sev;
+  uint16_t index = 0;
+
+  mLen = getVarLen(mf);
+
+#if !DUMP_DATA
+  // pass the data in chunks straight from the buffer
+  if (mf->sysexChunked())
   {
-    sysex_event sev;
-    uint16_t index = 0;
-
-    // collect all the bytes until the 0xf7 - boundaries are included in the message
-    sev.track = _trackId;
-    mLen = readVarLen(&mf->_fd);
-    sev.size = mLen;
-    if (eType==0xF0)       // add space for 0xF0
+    sysex_chunk ch;
+
+    ch.track = _trackId;
+    ch.status = eType;
+    ch.total = mLen;
+    ch.offset = 0;
+    ch.first = true;
+    do
     {
-      sev.data[index++] = eType;
-      sev.size++;
-    }
-    uint16_t minLen = min((unsigned int)sev.size, ARRAY_SIZE(sev.data));
-    // The length parameter includes the 0xF7 but not the start boundary.
-    // However, it may be bigger than our buffer will allow us to store.
-    for (uint16_t i=index; i<minLen; ++i)
-      sev.data[i] = mf->_fd.read();
-    if (sev.size>minLen)
-      mf->_fd.seek(sev.size-minLen, SeekCur);
+      ch.size = getBlock(mf, &ch.data, mLen - ch.offset);
+      ch.last = (ch.offset + ch.size >= mLen) || _endOfTrack;
+      mf->sendSysexChunk(&ch);
+      ch.offset += ch.size;
+      ch.first = false;
+    } while (!ch.last);
+    return;
+  }
+#endif
+
+  // collect all the bytes until the 0xf7 - boundaries are included in the message
+  sev.track = _trackId;
+  sev.size = mLen;
+  if (eType==0xF0)       // add space for 0xF0
+  {
+    sev.data[index++] = eType;
+    sev.size++;
+  }
+  uint16_t minLen = min(index+mLen, (uint32_t)ARRAY_SIZE(sev.data));
+  // The length parameter includes the 0xF7 but not the start boundary.
+  // However, it may be bigger than our buffer will allow us to store.
+  // Skip using mLen as sev.size only holds 16 bits.
+  for (uint16_t i=index; i<minLen; ++i)
+    sev.data[i] = getByte(mf);
+  if (index+mLen>minLen)
+    skipBytes(index+mLen-minLen);
 
 #if DUMP_DATA
-    DUMPS("[SYSX] Data:");
-    for (uint16_t i = 0; i<minLen; i++)
-    {
-      DUMPX(" ", sev.data[i]);
-    }
-    if (sev.size>minLen)
-      DUMPS("...");
+  DUMPS("[SYSX] Data:");
+  for (uint16_t i = 0; i<minLen; i++)
+  {
+    DUMPX(" ", sev.data[i]);
+  }
+  if (sev.size>minLen)
+    DUMPS("...");
 #else
-    if (mf->_sysexHandler != nullptr)
-      (mf->_sysexHandler)(&sev);
+  mf->dispatchSysex(&sev);
 #endif
-  }
-  break;
+}
 
-// ---------------------------- META
-  case 0xff:  // meta_event = 0xFF + <meta_type:1> + <length:v> + <event_data_bytes>
-  {
-    meta_event mev;
+__attribute__((noinline)) void MD_MFTrack::parseMeta(MD_MIDIFile *mf)
+// process a META event, the 0xff has been read
+{
+  uint8_t eType;
+  uint32_t mLen;
+  meta_event mev;
+  uint16_t minLen;
 
-    eType = mf->_fd.read();
-    mLen =  readVarLen(&mf->_fd);
+  eType = getByte(mf);
+  mLen =  getVarLen(mf);
 
-    mev.track = _trackId;
-    mev.size = mLen;
-    mev.type = eType;
+  mev.track = _trackId;
+  mev.size = mLen;
+  mev.type = eType;
 
-    DUMPX("[META] Type: 0x", eType);
-    DUMP("\tLen: ", mLen);
-    DUMPS("\t");
+  // read as much of the data as we can store, skip the rest
+  minLen = min((uint32_t)ARRAY_SIZE(mev.data), mLen);
+  for (uint16_t i = 0; i < minLen; ++i)
+    mev.data[i] = getByte(mf);
+  if (mLen > minLen)
+    skipBytes(mLen - minLen);
 
-    switch (eType)
-    {
-      case 0x2f:  // End of track
-      {
-        _endOfTrack = true;
-        DUMPS("END OF TRACK");
-      }
-      break;
-
-      case 0x51:  // set Tempo - really the microseconds per tick
-      {
-        uint32_t value = readMultiByte(&mf->_fd, MB_TRYTE);
-        
-        mf->setMicrosecondPerQuarterNote(value);
-        
-        mev.data[0] = (value >> 16) & 0xFF;
-        mev.data[1] = (value >> 8) & 0xFF;
-        mev.data[2] = value & 0xFF;
-        
-        DUMP("SET TEMPO to ", mf->getTickTime());
-        DUMP(" us/tick or ", mf->getTempo());
-        DUMPS(" beats/min");
-      }
-      break;
-
-      case 0x58:  // time signature
-      {
-        uint8_t n = mf->_fd.read();
-        uint8_t d = mf->_fd.read();
-        
-        mf->setTimeSignature(n, 1 << d);  // denominator is 2^n
-        mf->_fd.seek(mLen - 2, SeekCur);
-
-        mev.data[0] = n;
-        mev.data[1] = d;
-        mev.data[2] = 0;
-        mev.data[3] = 0;
-
-        DUMP("SET TIME SIGNATURE to ", mf->getTimeSignature() >> 8);
-        DUMP("/", mf->getTimeSignature() & 0xf);
-      }
-      break;
-
-      case 0x59:  // Key Signature
-      {
-        DUMPS("KEY SIGNATURE");
-        int8_t sf = mf->_fd.read();
-        uint8_t mi = mf->_fd.read();
-        const char* aaa[] = {"Cb", "Gb", "Db", "Ab", "Eb", "Bb", "F", "C", "G", "D", "A", "E", "B", "F#", "C#", "G#", "D#", "A#"};
-
-        if (sf >= -7 && sf <= 7) 
-        {
-          switch(mi)
-          {
-            case 0:
-              strcpy(mev.chars, aaa[sf+7]);
-              strcat(mev.chars, "M");
-              break;
-            case 1:
-              strcpy(mev.chars, aaa[sf+10]);
-              strcat(mev.chars, "m");
-              break;
-            default:
-              strcpy(mev.chars, "Err"); // error mi
-          }
-        } else
-          strcpy(mev.chars, "Err"); // error sf
-
-        mev.size = strlen(mev.chars); // change META length
-        DUMP(" ", mev.chars);
-      }
-      break;
-
-      case 0x00:  // Sequence Number
-      {
-        uint16_t x = readMultiByte(&mf->_fd, MB_WORD);
-
-        mev.data[0] = (x >> 8) & 0xFF;
-        mev.data[1] = x & 0xFF;
-
-        DUMP("SEQUENCE NUMBER ", mev.data[0]);
-        DUMP(" ", mev.data[1]);
-      }
-      break;
-
-      case 0x20:  // Channel Prefix
-      mev.data[0] = readMultiByte(&mf->_fd, MB_BYTE);
-      DUMP("CHANNEL PREFIX ", mev.data[0]);
-      break;
-
-      case 0x21:  // Port Prefix
-      mev.data[0] = readMultiByte(&mf->_fd, MB_BYTE);
-      DUMP("PORT PREFIX ", mev.data[0]);
-      break;
-
-#if SHOW_UNUSED_META
-      case 0x01:  // Text
-      DUMPS("TEXT ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x02:  // Copyright Notice
-      DUMPS("COPYRIGHT ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x03:  // Sequence or Track Name
-      DUMPS("SEQ/TRK NAME ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x04:  // Instrument Name
-      DUMPS("INSTRUMENT ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x05:  // Lyric
-      DUMPS("LYRIC ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x06:  // Marker
-      DUMPS("MARKER ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x07:  // Cue Point
-      DUMPS("CUE POINT ");
-      for (uint8_t i=0; i<mLen; i++)
-        DUMP("", (char)mf->_fd.read());
-      break;
-
-      case 0x54:  // SMPTE Offset
-      DUMPS("SMPTE OFFSET");
-      for (uint8_t i=0; i<mLen; i++)
-      {
-        DUMP(" ", mf->_fd.read());
-      }
-      break;
-
-      case 0x7F:  // Sequencer Specific Metadata
-      DUMPS("SEQ SPECIFIC");
-      for (uint8_t i=0; i<mLen; i++)
-      {
-        DUMPX(" ", mf->_fd.read());
-      }
-      break;
-#endif // SHOW_UNUSED_META
-
-      default:
-      {
-        uint8_t minLen = min(ARRAY_SIZE(mev.data), mLen);
-        
-        for (uint8_t i = 0; i < minLen; ++i)
-          mev.data[i] = mf->_fd.read(); // read next
-
-        mev.chars[minLen] = '\0'; // in case it is a string
-        if (mLen > ARRAY_SIZE(mev.data))
-          mf->_fd.seek(mLen-ARRAY_SIZE(mev.data), SeekCur);
-  //    DUMPS("IGNORED");
-      }
-      break;
-    }
-    if (mf->_metaHandler != nullptr)
-      (mf->_metaHandler)(&mev);
-  }
-  break;
-  
-// ---------------------------- UNKNOWN
-  default:
-    // stop playing this track as we cannot identify the eType
+  if (eType == 0x2f)  // End of track
     _endOfTrack = true;
-    DUMPX("[UKNOWN 0x", eType);
-    DUMPS("] Track aborted");
-    break;
-  }
+
+  mf->processMeta(&mev);
 }
 
-int MD_MFTrack::load(uint8_t trackId, MD_MIDIFile *mf)
+template <class S> int MD_MFTrack::load(uint8_t trackId, S *src)
 // return -1 if success, 0 if malformed header, 1 if next track past end of file
 {
   uint32_t  dat32;
@@ -456,9 +483,8 @@ int MD_MFTrack::load(uint8_t trackId, MD_MIDIFile *mf)
   {
     char    h[MTRK_HDR_SIZE+1]; // Header characters + nul
   
-    mf->_fd.readBytes(h, MTRK_HDR_SIZE+1);
+    src->read((uint8_t *)h, MTRK_HDR_SIZE);
     h[MTRK_HDR_SIZE] = '\0';
-  mf->_fd.seek(-1, SeekCur);
 
     if (strcmp(h, MTRK_HDR) != 0)
       return(0);
@@ -466,20 +492,41 @@ int MD_MFTrack::load(uint8_t trackId, MD_MIDIFile *mf)
 
   // Row read track chunk size and in bytes. This is not really necessary 
   // since the track MUST end with an end of track meta event.
-  dat32 = readMultiByte(&mf->_fd, MB_LONG);
+  dat32 = readMultiByte(src, MB_LONG);
   _length = dat32;
 
   // save where we are in the file as this is the start of offset for this track
-  _startOffset = mf->_fd.position();
+  _startOffset = src->position();
   _currOffset = 0;
+  _buf = _bufData;
+  _bufOffset = 0;
+  _bufLen = 0;
 
   // Advance the file pointer to the start of the next track;
-  if (!mf->_fd.seek(_startOffset+_length), SeekSet)
+  if (!src->seek(_startOffset+_length))
     return(1);
 
   return(-1);
 }
 
+// the byte sources used by MD_MIDIFile::load()
+template int MD_MFTrack::load(uint8_t trackId, MD_MFSource *src);
+template int MD_MFTrack::load(uint8_t trackId, MD_MFSourceMem *src);
+
+void MD_MFTrack::setMemory(const uint8_t *image, uint32_t size)
+// Play this track from the file image in memory
+{
+  // make sure a truncated file does not take us past the end of the image
+  if (_startOffset > size)
+    _length = 0;
+  else if (_startOffset + _length > size)
+    _length = size - _startOffset;
+
+  _buf = image + _startOffset;
+  _bufOffset = 0;
+  _bufLen = _length;
+}
+
 #if DUMP_DATA
 void MD_MFTrack::dump(void)
 {
@@ -489,6 +536,7 @@ void MD_MFTrack::dump(void)
   DUMP("\nFile Location:\t\t", _startOffset);
   DUMP("\nEnd of Track:\t\t", _endOfTrack);
   DUMP("\nCurrent buffer offset:\t", _currOffset);
+  DUMP("\nIn memory:\t\t", _buf != _bufData);
 }
 #endif // DUMP_DATA
 